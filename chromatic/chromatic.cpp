@@ -17,108 +17,1769 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <iostream>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
-#include <boost/tokenizer.hpp>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
-#include "chromaticInterval.h"
-#include "chromaticNote.h"
+#include "chromaticTypes.h"
 #include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticPitchClassSet.h"
+#include "chromaticScaleIndex.h"
+#include "chromaticParser.h"
+#include "chromaticOutput.h"
+#include "chromaticThreadPool.h"
+#include "chromaticGenerator.h"
+#include "chromaticTranspose.h"
+#include "chromaticFiles.h"
+#include "chromaticMidi.h"
+#include "chromaticServer.h"
+#include "chromaticCache.h"
+#include "chromaticStats.h"
+#include "chromaticProgressionFile.h"
+#include "chromaticProgressionIndex.h"
+#include "chromaticMarkov.h"
 
 using namespace chromatic;
 
-Note noteFromString( const wstring& str )
+#ifdef CHROMATIC_STATS
+
+// Heap allocations are counted by chromaticAllocations.cpp, which stats
+// builds link
+
+bool g_statsJson = false;
+
+void printStatsAtExit()
+{
+  printStats( stderr, g_statsJson );
+}
+
+#endif
+
+enum QueryStatus: int {
+  Query_OK = 0,
+  Query_Syntax,
+  Query_Unknown,
+  Query_Invalid
+};
+
+QueryStatus printParseError( OutputWriter& writer, const char* what, const StringView& str, const ParseError& error )
+{
+  string message = "Invalid ";
+  message.append( what );
+  message.append( " \"" );
+  message.append( str.data(), str.length() );
+  message.append( "\": " );
+  message.append( error.getString() );
+  message.append( " at character " );
+  message.append( std::to_string( (unsigned long long)error.position + 1 ) );
+  writer.writeError( message );
+  return Query_Invalid;
+}
+
+QueryStatus printChord( OutputWriter& writer, const StringView& str )
+{
+  Triad chord;
+  ParseError error;
+  if ( !parseChord( str, chord, error ) )
+    return printParseError( writer, "chord", str, error );
+  writer.writeChord( chord );
+  return Query_OK;
+}
+
+QueryStatus printScale( OutputWriter& writer, const StringView& str )
+{
+  Scale scale;
+  ParseError error;
+  if ( !parseScale( str, scale, error ) )
+    return printParseError( writer, "scale", str, error );
+  writer.writeScale( scale );
+  return Query_OK;
+}
+
+QueryStatus printProgression( OutputWriter& writer, const StringView& str, const StringView& scaleStr )
+{
+  Scale scale;
+  ParseError error;
+  if ( !parseScale( scaleStr, scale, error ) )
+    return printParseError( writer, "scale", scaleStr, error );
+  ChordProgression progression( scale );
+  if ( !progression.parse( str, error ) )
+    return printParseError( writer, "progression", str, error );
+  writer.writeProgression( progression );
+  return Query_OK;
+}
+
+QueryStatus printVoicing( OutputWriter& writer, int argc, const char* const argv[] )
+{
+  Scale scale;
+  ParseError error;
+  if ( !parseScale( argv[1], scale, error ) )
+    return printParseError( writer, "scale", argv[1], error );
+  ChordProgression progression( scale );
+  if ( !progression.parse( argv[0], error ) )
+    return printParseError( writer, "progression", argv[0], error );
+  Pitch low = 48, high = 79;
+  for ( int i = 2; i < argc; i++ )
+  {
+    bool isLow = startsWithNoCase( argv[i], "--low=" );
+    if ( !isLow && !startsWithNoCase( argv[i], "--high=" ) )
+      return Query_Syntax;
+    StringView value( argv[i] + ( isLow ? 6 : 7 ) );
+    if ( !parsePitch( value, isLow ? low : high, error ) )
+      return printParseError( writer, "pitch", value, error );
+  }
+  VoiceLeader leader( low, high );
+  VoicingVector voicings;
+  int movement = leader.lead( progression.getSteps(), voicings );
+  if ( movement < 0 ) {
+    string message = "No voicing of the progression fits between ";
+    message.append( g_notesSharpStr[pitchClass( low )] );
+    message.append( std::to_string( (long long)pitchOctave( low ) ) );
+    message.append( " and " );
+    message.append( g_notesSharpStr[pitchClass( high )] );
+    message.append( std::to_string( (long long)pitchOctave( high ) ) );
+    writer.writeError( message );
+    return Query_Invalid;
+  }
+  writer.writeVoicing( progression, voicings, movement );
+  return Query_OK;
+}
+
+QueryStatus printIdentity( OutputWriter& writer, const StringView& str )
+{
+  Tokenizer tokenizer( str, '-' );
+  StringView token;
+  size_t position;
+  PitchClassSet set;
+  Note bass = Note_C;
+  ParseError error;
+  while ( tokenizer.next( token, position ) )
+  {
+    Note note;
+    if ( !parseNote( token, note, error ) )
+      return printParseError( writer, "note", token, error );
+    if ( set.empty() )
+      bass = note;
+    set.add( note );
+  }
+  Triad chord;
+  Inversion inversion = Inversion_Root;
+  bool found = identifyChord( set, bass, chord, inversion );
+  writer.writeIdentity( str, found, chord, inversion );
+  return Query_OK;
+}
+
+QueryStatus printKeys( OutputWriter& writer, const StringView& str )
 {
-  for ( int i = 0; i < 12; i++ )
+  Tokenizer tokenizer( str, '-' );
+  StringView token;
+  size_t position;
+  ScaleSet scales = g_allScales;
+  ParseError error;
+  while ( tokenizer.next( token, position ) )
+  {
+    Triad chord;
+    if ( !parseChord( token, chord, error ) )
+      return printParseError( writer, "chord", token, error );
+    scales &= scalesContaining( chord );
+  }
+  writer.writeKeys( str, scales );
+  return Query_OK;
+}
+
+// Writes the key of a sliding window over a stream of notes whenever it
+// changes, starting once the window first fills up
+
+class KeyFollower {
+protected:
+  KeyTracker tracker;
+  size_t window;
+  unsigned long long position;
+  int current;
+  void report( OutputWriter& writer )
   {
-    if ( !_wcsicmp( str.c_str(), g_notesSharpStr[i] ) || !_wcsicmp( str.c_str(), g_notesFlatStr[i] ) )
-      return (Note)i;
+    int best = tracker.getBest();
+    if ( best == current )
+      return;
+    current = best;
+    writer.writeModulation( position, tracker.getKey() );
   }
-  return Note_C;
+public:
+  explicit KeyFollower( size_t _window ): tracker( _window ), window( _window ), position( 0 ), current( -1 ) {}
+  unsigned long long size() const
+  {
+    return position;
+  }
+  void push( OutputWriter& writer, Note note )
+  {
+    tracker.push( note );
+    if ( ++position >= window )
+      report( writer );
+  }
+  // Reports a stream shorter than the window as a whole
+  void finish( OutputWriter& writer )
+  {
+    if ( current < 0 && position )
+      report( writer );
+  }
+};
+
+bool parseKeyWindow( const char* arg, size_t& window )
+{
+  if ( !startsWithNoCase( arg, "--window=" ) )
+    return false;
+  window = strtoul( arg + 9, NULL, 10 );
+  return window > 0 && window <= KeyTracker::maxWindow;
 }
 
-Triad chordFromString( wstring str )
+QueryStatus printKey( OutputWriter& writer, int argc, const char* const argv[] )
 {
-  // rather nave
-  ChordType type = ChordType_Major;
-  if ( str.length() > 1 )
+  size_t window = 0;
+  const char* notes = NULL;
+  for ( int i = 0; i < argc; i++ )
+  {
+    if ( !strncmp( argv[i], "--", 2 ) ) {
+      if ( !parseKeyWindow( argv[i], window ) )
+        return Query_Syntax;
+    } else if ( !notes )
+      notes = argv[i];
+    else
+      return Query_Syntax;
+  }
+  if ( !notes )
+    return Query_Syntax;
+  Tokenizer tokenizer( notes, '-' );
+  StringView token;
+  size_t position;
+  float histogram[12] = { 0 };
+  KeyFollower follower( window );
+  ParseError error;
+  vector<Note> parsed;
+  while ( tokenizer.next( token, position ) )
   {
-    wstring suf = str.substr( str.length()-1 );
-    if ( str.length() > 4 ) {
-      suf = str.substr( str.length()-4 );
-      if ( boost::iequals( suf, L"sus4" ) ) {
-        type = ChordType_SuspendedFourth;
-        str.erase( str.length()-4, 4 );
-      } else if ( boost::iequals( suf, L"sus2" ) ) {
-        type = ChordType_SuspendedSecond;
-        str.erase( str.length()-4, 4 );
+    Note note;
+    if ( !parseNote( token, note, error ) )
+      return printParseError( writer, "note", token, error );
+    parsed.push_back( note );
+  }
+  if ( window ) {
+    for ( size_t i = 0; i < parsed.size(); i++ )
+      follower.push( writer, parsed[i] );
+    follower.finish( writer );
+    return Query_OK;
+  }
+  for ( size_t i = 0; i < parsed.size(); i++ )
+    histogram[parsed[i]] += 1.0f;
+  KeyEstimateVector estimates;
+  estimateKeys( histogram, estimates );
+  writer.writeKey( notes, estimates, 3 );
+  return Query_OK;
+}
+
+// Runs tasks on a thread pool, each formatting into the writer of the
+// worker it runs on, and writes their output to standard output in the
+// order they were submitted. At most four tasks per thread are held at
+// once, so output is streamed no matter how many tasks there are.
+
+class OrderedRunner {
+public:
+  typedef std::function<void( OutputWriter& )> Task;
+protected:
+  struct Slot {
+    Task task;
+    string output;
+    bool done;
+  };
+  ThreadPool pool;
+  vector<OutputWriter*> writers;
+  vector<Slot> slots;
+  std::mutex doneLock;
+  std::condition_variable doneSignal;
+  size_t submitted;
+  size_t written;
+  void writeOldest()
+  {
+    Slot& slot = slots[written % slots.size()];
+    {
+      std::unique_lock<std::mutex> lock( doneLock );
+      doneSignal.wait( lock, [&slot]() { return slot.done; } );
+    }
+    fputs( slot.output.c_str(), stdout );
+    written++;
+  }
+public:
+  OrderedRunner( OutputFormat format, size_t threads ): pool( threads ), submitted( 0 ), written( 0 )
+  {
+    for ( size_t i = 0; i < pool.size(); i++ )
+      writers.push_back( new OutputWriter( format, NULL, 0 ) );
+    slots.resize( pool.size() * 4 );
+  }
+  ~OrderedRunner()
+  {
+    finish();
+    for ( size_t i = 0; i < writers.size(); i++ )
+      delete writers[i];
+  }
+  size_t size() const
+  {
+    return pool.size();
+  }
+  void submit( const Task& task )
+  {
+    if ( submitted - written == slots.size() )
+      writeOldest();
+    Slot* slot = &slots[submitted % slots.size()];
+    slot->task = task;
+    slot->output.clear();
+    slot->done = false;
+    pool.submit( [this, slot]() {
+      OutputWriter& writer = *writers[ThreadPool::currentWorker()];
+      writer.getBuffer().swap( slot->output );
+      slot->task( writer );
+      writer.getBuffer().swap( slot->output );
+      slot->task = nullptr;
+      std::lock_guard<std::mutex> lock( doneLock );
+      slot->done = true;
+      doneSignal.notify_all();
+    } );
+    submitted++;
+  }
+  void finish()
+  {
+    while ( written < submitted )
+      writeOldest();
+    fflush( stdout );
+  }
+};
+
+// Generated progressions are split into chunks by descending into
+// prefixes until each has few enough completions. Chunks are enumerated
+// in parallel and written out in order, so memory use stays bounded no
+// matter how many progressions there are.
+
+const unsigned long long g_generateChunkSize = 16384;
+
+class GenerateSink {
+protected:
+  OutputWriter& writer;
+  const Scale& scale;
+public:
+  GenerateSink( OutputWriter& _writer, const Scale& _scale ): writer( _writer ), scale( _scale ) {}
+  void operator()( const Degree* degrees, int length )
+  {
+    writer.writeGenerated( scale, degrees, length );
+  }
+};
+
+void splitGenerated( OrderedRunner& runner, const ProgressionGenerator& generator, Degree* prefix, int length )
+{
+  if ( length == generator.getLength() || generator.count( prefix, length ) <= g_generateChunkSize ) {
+    vector<Degree> chunk( prefix, prefix + length );
+    runner.submit( [&generator, chunk]( OutputWriter& writer ) {
+      GenerateSink sink( writer, generator.getScale() );
+      generator.enumerate( chunk.empty() ? NULL : &chunk[0], (int)chunk.size(), sink );
+    } );
+    return;
+  }
+  for ( int degree = Degree_Tonic; degree <= Degree_Subsemitone; degree++ )
+  {
+    prefix[length] = (Degree)degree;
+    if ( generator.count( prefix, length + 1 ) )
+      splitGenerated( runner, generator, prefix, length + 1 );
+  }
+}
+
+QueryStatus printGenerated( OutputWriter& writer, int argc, const char* const argv[], size_t threads )
+{
+  Scale scale;
+  GenerateConstraints constraints;
+  ParseError error;
+  bool countOnly = false;
+  if ( !parseScale( argv[0], scale, error ) )
+    return printParseError( writer, "scale", argv[0], error );
+  char* end;
+  constraints.length = (int)strtol( argv[1], &end, 10 );
+  if ( *end || constraints.length < 1 || constraints.length > g_generateMaxLength )
+    return Query_Syntax;
+  for ( int i = 2; i < argc; i++ )
+  {
+    StringView arg( argv[i] );
+    StringView value = arg.substr( std::min( arg.find( '=' ), arg.length() - 1 ) + 1 );
+    DegreeVector degrees;
+    if ( equalsNoCase( argv[i], "--count" ) )
+      countOnly = true;
+    else if ( startsWithNoCase( argv[i], "--max-repeat=" ) ) {
+      constraints.maxRepeat = (int)strtol( argv[i] + 13, &end, 10 );
+      if ( *end || constraints.maxRepeat < 1 )
+        return Query_Syntax;
+    } else if ( startsWithNoCase( argv[i], "--start=" ) || startsWithNoCase( argv[i], "--end=" ) ) {
+      unsigned char& mask = startsWithNoCase( argv[i], "--start=" ) ? constraints.start : constraints.end;
+      if ( !parseDegrees( value, degrees, error ) )
+        return printParseError( writer, "degree", value, error );
+      if ( degrees.size() != 1 )
+        return Query_Syntax;
+      mask = (unsigned char)( 1 << degrees[0] );
+    } else if ( startsWithNoCase( argv[i], "--cadence=" ) ) {
+      if ( !parseDegrees( value, constraints.cadence, error ) )
+        return printParseError( writer, "cadence", value, error );
+    } else if ( startsWithNoCase( argv[i], "--ban=" ) ) {
+      Tokenizer tokenizer( value, ',' );
+      StringView token;
+      size_t position;
+      while ( tokenizer.next( token, position ) )
+      {
+        if ( !parseDegrees( token, degrees, error ) )
+          return printParseError( writer, "transition", token, error );
+        if ( degrees.size() != 2 )
+          return Query_Syntax;
+        constraints.banned[degrees[0]] |= (unsigned char)( 1 << degrees[1] );
       }
-    } else if ( boost::iequals( suf, L"m" ) ) {
-      type = ChordType_Minor;
-      str.erase( str.length()-1, 1 );
-    } else if ( boost::iequals( suf, L"a" ) ) {
-      type = ChordType_Augmented;
-      str.erase( str.length()-1, 1 );
-    } else if ( boost::iequals( suf, L"o" ) ) {
-      type = ChordType_Diminished;
-      str.erase( str.length()-1, 1 );
+    } else
+      return Query_Syntax;
+  }
+  ProgressionGenerator generator( scale, constraints );
+  unsigned long long count = generator.count( NULL, 0 );
+  writer.writeGenerateSummary( scale, constraints.length, count );
+  if ( countOnly || !count )
+    return Query_OK;
+  if ( threads > 1 ) {
+    writer.flush();
+    OrderedRunner runner( writer.getFormat(), threads );
+    Degree prefix[g_generateMaxLength];
+    splitGenerated( runner, generator, prefix, 0 );
+    runner.finish();
+  } else {
+    GenerateSink sink( writer, scale );
+    generator.enumerate( NULL, 0, sink );
+  }
+  return Query_OK;
+}
+
+const char* g_actionSyntax[][2] = {
+  { "chord", "chord <name>" },
+  { "scale", "scale <name>" },
+  { "progression", "progression <progression> <scale>" },
+  { "identify", "identify <notes>" },
+  { "keys", "keys <chords>" },
+  { "key", "key [--window=<notes>] <notes|->" },
+  { "voice", "voice <progression> <scale> [--low=<pitch>] [--high=<pitch>]" },
+  { "generate", "generate <scale> <length> [--start=<degree>] [--end=<degree>] [--cadence=<progression>]\n"
+    "  [--ban=<degree>-<degree>,...] [--max-repeat=<count>] [--count]" }
+};
+
+void printUsage( const char* executable )
+{
+  printf( "Syntax: %s [--format=text|json|csv] [--threads=<count>] [--scales=<file>]\n"
+    "  [--cache=<entries>] [--cache-file=<file>] [--stats[=text|json]] <action>\n", executable );
+  printf( "Valid actions: chord, scale, progression, identify, keys, key, voice, generate, transpose, midi, pack, unpack, index, find, train, sample, batch, serve, client\n" );
+}
+
+const char* findSyntax( const char* action )
+{
+  for ( size_t i = 0; i < sizeof( g_actionSyntax ) / sizeof( g_actionSyntax[0] ); i++ )
+    if ( equalsNoCase( action, g_actionSyntax[i][0] ) )
+      return g_actionSyntax[i][1];
+  return NULL;
+}
+
+// serve answers only the lookups whose output is bounded by the request.
+// The others can run for seconds and build up output without limit on the
+// one thread that serves every connection.
+
+const char* g_servedActions[] = { "chord", "scale", "progression", "identify", "keys" };
+
+bool isServedAction( const char* action )
+{
+  for ( size_t i = 0; i < sizeof( g_servedActions ) / sizeof( g_servedActions[0] ); i++ )
+    if ( equalsNoCase( action, g_servedActions[i] ) )
+      return true;
+  return false;
+}
+
+void printSyntax( const char* executable, const char* action )
+{
+  const char* syntax = findSyntax( action );
+  if ( syntax )
+    printf( "Syntax: %s %s\n", executable, syntax );
+  else
+    printUsage( executable );
+}
+
+QueryStatus runQuery( OutputWriter& writer, const char* action, int argc, const char* const argv[], size_t threads = 1 )
+{
+  CHROMATIC_STATS_SCOPE( Stats_Query );
+  if ( equalsNoCase( action, "chord" ) )
+  {
+    if ( argc < 1 )
+      return Query_Syntax;
+    return printChord( writer, argv[0] );
+  }
+  else if ( equalsNoCase( action, "scale" ) )
+  {
+    if ( argc < 1 )
+      return Query_Syntax;
+    return printScale( writer, argv[0] );
+  }
+  else if ( equalsNoCase( action, "progression" ) )
+  {
+    if ( argc < 2 )
+      return Query_Syntax;
+    return printProgression( writer, argv[0], argv[1] );
+  }
+  else if ( equalsNoCase( action, "identify" ) )
+  {
+    if ( argc < 1 )
+      return Query_Syntax;
+    return printIdentity( writer, argv[0] );
+  }
+  else if ( equalsNoCase( action, "keys" ) )
+  {
+    if ( argc < 1 )
+      return Query_Syntax;
+    return printKeys( writer, argv[0] );
+  }
+  else if ( equalsNoCase( action, "key" ) )
+    return printKey( writer, argc, argv );
+  else if ( equalsNoCase( action, "voice" ) )
+  {
+    if ( argc < 2 )
+      return Query_Syntax;
+    return printVoicing( writer, argc, argv );
+  }
+  else if ( equalsNoCase( action, "generate" ) )
+  {
+    if ( argc < 2 )
+      return Query_Syntax;
+    return printGenerated( writer, argc, argv, threads );
+  }
+  return Query_Unknown;
+}
+
+// Batch mode reads input in blocks of lines that are answered on a thread
+// pool. Each worker formats into its own writer, and finished blocks are
+// written out strictly in input order, their errors included.
+
+const size_t g_batchBlockLines = 4096;
+
+struct BatchBlock {
+  string input;
+  string output;
+  string errors;
+  unsigned long long firstLine;
+  unsigned long long queries;
+  unsigned long long failures;
+  bool done;
+};
+
+bool appendLine( FILE* input, string& buffer )
+{
+  char chunk[1024];
+  size_t start = buffer.length();
+  while ( fgets( chunk, 1024, input ) )
+  {
+    buffer.append( chunk );
+    if ( buffer[buffer.length()-1] == '\n' )
+      return true;
+  }
+  if ( buffer.length() == start )
+    return false;
+  buffer.push_back( '\n' );
+  return true;
+}
+
+// Splits a line ending in a newline on whitespace in place, returning the
+// start of the next line
+
+char* splitQuery( char* c, vector<const char*>& args )
+{
+  CHROMATIC_STATS_SCOPE( Stats_Tokenize );
+  args.clear();
+  for ( bool separated = true; *c != '\n'; c++ )
+  {
+    if ( *c == ' ' || *c == '\t' || *c == '\r' ) {
+      *c = '\0';
+      separated = true;
+    } else if ( separated ) {
+      args.push_back( c );
+      separated = false;
     }
   }
-  return Triad( noteFromString( str ), type );
+  *c++ = '\0';
+  return c;
 }
 
-DiatonicScale scaleFromString( wstring str )
+// Answers a split query from the cache when one is given, keeping the
+// results of successful queries in it. The key is the query with the
+// action in lower case, reusing the given buffer.
+
+QueryStatus runCachedQuery( OutputWriter& writer, ResultCache* cache, const vector<const char*>& args, string& key )
 {
-  DiatonicScaleMode mode = ScaleMode_Major;
-  if ( boost::iequals( str.substr( str.length()-1 ), L"m" ) ) {
-    mode = ScaleMode_Minor;
-    str.erase( str.length()-1, 1 );
+  if ( !cache )
+    return runQuery( writer, args[0], (int)args.size() - 1, &args[0] + 1 );
+  key.clear();
+  for ( const char* c = args[0]; *c; c++ )
+    key.push_back( lowerAscii( *c ) );
+  for ( size_t i = 1; i < args.size(); i++ )
+  {
+    key.push_back( ' ' );
+    key.append( args[i] );
   }
-  Note note = noteFromString( str );
-  return DiatonicScale( note, mode );
+  string& buffer = writer.getBuffer();
+  if ( cache->find( key, buffer ) )
+    return Query_OK;
+  size_t start = buffer.length();
+  QueryStatus status = runQuery( writer, args[0], (int)args.size() - 1, &args[0] + 1 );
+  if ( status == Query_OK )
+    cache->insert( key, buffer.data() + start, buffer.length() - start );
+  return status;
 }
 
-int wmain( int argc, wchar_t* argv[] )
+void runBatchBlock( OutputWriter& writer, ResultCache* cache, BatchBlock& block, vector<const char*>& args, string& key )
+{
+  writer.getBuffer().swap( block.output );
+  writer.setErrorBuffer( &block.errors );
+  unsigned long long line = block.firstLine;
+  char* c = &block.input[0];
+  char* end = c + block.input.length();
+  for ( ; c < end; line++ )
+  {
+    c = splitQuery( c, args );
+    if ( args.empty() || args[0][0] == '#' )
+      continue;
+    block.queries++;
+    QueryStatus status = runCachedQuery( writer, cache, args, key );
+    if ( status != Query_OK ) {
+      block.failures++;
+      if ( status != Query_Invalid )
+        writer.writeError( "Invalid query on line " + std::to_string( line ) );
+    }
+  }
+  writer.setErrorBuffer( NULL );
+  writer.getBuffer().swap( block.output );
+}
+
+void printCacheSummary( ResultCache& cache )
+{
+  unsigned long long lookups = cache.getHits() + cache.getMisses();
+  fprintf( stderr, "Cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %llu results\n",
+    cache.getHits(), cache.getMisses(), lookups ? 100.0 * cache.getHits() / lookups : 0.0,
+    cache.getEvictions(), (unsigned long long)cache.size() );
+}
+
+int runBatch( OutputWriter& writer, FILE* input, size_t threads, ResultCache* cache )
+{
+  ThreadPool pool( threads );
+  vector<OutputWriter*> writers;
+  vector<vector<const char*> > args( pool.size() );
+  vector<string> keys( pool.size() );
+  for ( size_t i = 0; i < pool.size(); i++ )
+    writers.push_back( new OutputWriter( writer.getFormat(), NULL, 0 ) );
+
+  vector<BatchBlock> blocks( pool.size() * 4 );
+  std::mutex doneLock;
+  std::condition_variable doneSignal;
+  size_t submitted = 0, written = 0;
+  unsigned long long lines = 0, queries = 0, failures = 0;
+  bool eof = false;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  writer.writeHeader();
+  writer.flush();
+  while ( !eof || written < submitted )
+  {
+    while ( !eof && submitted - written < blocks.size() )
+    {
+      BatchBlock& block = blocks[submitted % blocks.size()];
+      block.input.clear();
+      block.output.clear();
+      block.errors.clear();
+      block.firstLine = lines + 1;
+      block.queries = block.failures = 0;
+      block.done = false;
+      size_t count = 0;
+      while ( count < g_batchBlockLines && appendLine( input, block.input ) )
+        count++;
+      lines += count;
+      if ( count < g_batchBlockLines )
+        eof = true;
+      if ( !count )
+        break;
+      BatchBlock* target = &block;
+      pool.submit( [&, target]() {
+        size_t worker = ThreadPool::currentWorker();
+        runBatchBlock( *writers[worker], cache, *target, args[worker], keys[worker] );
+        std::lock_guard<std::mutex> lock( doneLock );
+        target->done = true;
+        doneSignal.notify_all();
+      } );
+      submitted++;
+    }
+    if ( written < submitted )
+    {
+      BatchBlock& block = blocks[written % blocks.size()];
+      {
+        std::unique_lock<std::mutex> lock( doneLock );
+        doneSignal.wait( lock, [&block]() { return block.done; } );
+      }
+      CHROMATIC_STATS_SCOPE( Stats_Flush );
+      fputs( block.output.c_str(), stdout );
+      fputs( block.errors.c_str(), stderr );
+      queries += block.queries;
+      failures += block.failures;
+      written++;
+    }
+  }
+  fflush( stdout );
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  for ( size_t i = 0; i < writers.size(); i++ )
+    delete writers[i];
+
+  fprintf( stderr, "%llu queries (%llu invalid) in %.3f seconds on %u threads, %.0f queries/sec\n",
+    queries, failures, seconds, (unsigned int)pool.size(), seconds > 0.0 ? (double)queries / seconds : 0.0 );
+  if ( cache )
+    printCacheSummary( *cache );
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Adds scale modes from a file of "<key> <steps> <name>" lines, skipping
+// empty lines and lines starting with #
+
+bool loadScaleModes( const char* path )
+{
+  FILE* input = openFile( path, "r" );
+  if ( !input ) {
+    fprintf( stderr, "Could not open %s\n", path );
+    return false;
+  }
+  string line;
+  bool valid = true;
+  for ( unsigned long long number = 1; valid && appendLine( input, line ); number++, line.clear() )
+  {
+    StringView definition( line );
+    size_t end = definition.find_last_not_of( " \t\r\n" );
+    definition = definition.substr( 0, end == StringView::npos ? 0 : end + 1 );
+    if ( definition.empty() || definition[0] == '#' )
+      continue;
+    string key, name;
+    unsigned short pattern;
+    ParseError error;
+    if ( !parseScaleModeDef( definition, key, name, pattern, error ) ) {
+      fprintf( stderr, "Invalid scale mode on line %llu of %s: %s at character %llu\n",
+        number, path, error.getString(), (unsigned long long)error.position + 1 );
+      valid = false;
+    } else if ( !g_scales.add( key, name, pattern ) ) {
+      fprintf( stderr, "Could not add scale mode %s on line %llu of %s (duplicate key, more than seven notes or too many modes)\n",
+        key.c_str(), number, path );
+      valid = false;
+    }
+  }
+  fclose( input );
+  return valid;
+}
+
+// Transposition streams its input to standard output. Text is rewritten
+// chord by chord: words that read as chords or notes, starting with a
+// capital letter and possibly joined by dashes or slashes, get their roots
+// moved, and everything else is copied as is. Raw input is an array of
+// note bytes or four-byte triads and is transposed in place block by
+// block.
+
+const size_t g_transposeBlockSize = 1 << 20;
+
+struct TransposeSpan {
+  size_t start;
+  size_t end;
+};
+
+void transposeText( string& text, string& output, Semitones interval, vector<TransposeSpan>& spans, vector<Note>& roots )
 {
-  if ( argc < 2 ) {
-    wprintf_s( L"Syntax: %s <action>\r\n", argv[0] );
-    wprintf_s( L"Valid actions: chord, scale, progression\r\n" );
+  spans.clear();
+  roots.clear();
+  size_t length = text.length();
+  for ( size_t i = 0; i < length; )
+  {
+    if ( isspace( (unsigned char)text[i] ) ) {
+      i++;
+      continue;
+    }
+    size_t end = i;
+    while ( end < length && !isspace( (unsigned char)text[end] ) )
+      end++;
+    // Every part of the word must be a chord for any of it to change
+    size_t first = spans.size();
+    bool chords = true;
+    for ( size_t part = i; part < end && chords; )
+    {
+      size_t partEnd = part;
+      while ( partEnd < end && text[partEnd] != '-' && text[partEnd] != '/' )
+        partEnd++;
+      StringView token( text.data() + part, partEnd - part );
+      Triad chord;
+      ParseError error;
+      size_t rootEnd = 0;
+      Note root;
+      chords = !token.empty() && token[0] >= 'A' && token[0] <= 'G'
+        && parseChord( token, chord, error ) && parseNote( token, rootEnd, root, error );
+      if ( chords ) {
+        TransposeSpan span = { part, part + rootEnd };
+        spans.push_back( span );
+        roots.push_back( root );
+      }
+      part = partEnd + 1;
+    }
+    if ( !chords ) {
+      spans.resize( first );
+      roots.resize( first );
+    }
+    i = end;
+  }
+  if ( !roots.empty() )
+    transposeNotes( &roots[0], roots.size(), interval );
+  output.clear();
+  size_t copied = 0;
+  for ( size_t i = 0; i < spans.size(); i++ )
+  {
+    output.append( text, copied, spans[i].start - copied );
+    output.append( g_notesSharpStr[roots[i]] );
+    copied = spans[i].end;
+  }
+  output.append( text, copied, string::npos );
+}
+
+int runTranspose( const char* executable, int argc, char* argv[] )
+{
+  const char* syntax = "Syntax: %s transpose <semitones> [--raw=notes|triads] [file]\n";
+  char* end;
+  Semitones interval = argc > 0 ? (Semitones)strtol( argv[0], &end, 10 ) : 0;
+  if ( argc < 1 || !argv[0][0] || *end ) {
+    printf( syntax, executable );
     return EXIT_FAILURE;
   }
-  if ( !_wcsicmp( argv[1], L"chord" ) )
+  unsigned int rawLanes = 0;
+  const char* path = NULL;
+  for ( int i = 1; i < argc; i++ )
   {
-    if ( argc < 3 ) {
-      wprintf_s( L"Syntax: %s chord <name>\r\n", argv[0] );
+    if ( equalsNoCase( argv[i], "--raw=notes" ) )
+      rawLanes = 0xF;
+    else if ( equalsNoCase( argv[i], "--raw=triads" ) )
+      rawLanes = 0x7;
+    else if ( !path )
+      path = argv[i];
+    else {
+      printf( syntax, executable );
+      return EXIT_FAILURE;
+    }
+  }
+  FILE* input = stdin;
+  if ( path && strcmp( path, "-" ) ) {
+    input = openFile( path, rawLanes ? "rb" : "r" );
+    if ( !input ) {
+      fprintf( stderr, "Could not open %s\n", path );
       return EXIT_FAILURE;
     }
-    Triad chord = chordFromString( argv[2] );
-    chord.print();
-    return EXIT_SUCCESS;
   }
-  else if ( !_wcsicmp( argv[1], L"scale" ) )
+  unsigned long long total = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if ( rawLanes ) {
+#ifdef _WIN32
+    _setmode( _fileno( input ), _O_BINARY );
+    _setmode( _fileno( stdout ), _O_BINARY );
+#endif
+    vector<unsigned char> block( g_transposeBlockSize );
+    size_t count;
+    while ( ( count = fread( &block[0], 1, block.size(), input ) ) > 0 )
+    {
+      detail::transposeBytes( &block[0], count, interval, rawLanes );
+      fwrite( &block[0], 1, count, stdout );
+      total += count;
+    }
+  } else {
+    string text, output;
+    vector<TransposeSpan> spans;
+    vector<Note> roots;
+    text.reserve( g_transposeBlockSize );
+    bool more = true;
+    while ( more )
+    {
+      text.clear();
+      do
+        more = appendLine( input, text );
+      while ( more && text.length() < g_transposeBlockSize );
+      transposeText( text, output, interval, spans, roots );
+      fputs( output.c_str(), stdout );
+      total += text.length();
+    }
+  }
+  fflush( stdout );
+  if ( input != stdin )
+    fclose( input );
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu bytes in %.3f seconds, %.1f MB/sec\n", total, seconds,
+    seconds > 0.0 ? (double)total / seconds / 1000000.0 : 0.0 );
+  return EXIT_SUCCESS;
+}
+
+// MIDI import analyzes each file on the thread pool, with one analyzer
+// per worker. Files are named on the command line, found by walking
+// directories for .mid and .midi files, or read one path per line from
+// standard input, and are only opened once their turn comes.
+
+// Notes of a text stream are separated by whitespace, dashes or commas;
+// anything else that is not a note is skipped and counted
+
+bool isNoteSeparator( char c )
+{
+  return isspace( (unsigned char)c ) || c == '-' || c == ',';
+}
+
+int runKeyStream( const char* executable, OutputWriter& writer, int argc, char* argv[] )
+{
+  size_t window = 0;
+  bool raw = false;
+  bool syntax = argc < 1 || strcmp( argv[argc-1], "-" ) != 0;
+  for ( int i = 0; i < argc - 1 && !syntax; i++ )
   {
-    if ( argc < 3 ) {
-      wprintf_s( L"Syntax: %s scale <name>\r\n", argv[0] );
+    if ( equalsNoCase( argv[i], "--raw" ) )
+      raw = true;
+    else if ( !parseKeyWindow( argv[i], window ) )
+      syntax = true;
+  }
+  if ( syntax ) {
+    printf( "Syntax: %s key [--window=<notes>] [--raw] -\n", executable );
+    return EXIT_FAILURE;
+  }
+  writer.writeHeader();
+  unsigned long long counts[12] = { 0 };
+  unsigned long long skipped = 0;
+  KeyFollower follower( window );
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if ( raw ) {
+#ifdef _WIN32
+    _setmode( _fileno( stdin ), _O_BINARY );
+#endif
+    vector<unsigned char> block( g_transposeBlockSize );
+    size_t count;
+    while ( ( count = fread( &block[0], 1, block.size(), stdin ) ) > 0 )
+    {
+      for ( size_t i = 0; i < count; i++ )
+      {
+        if ( block[i] >= 12 ) {
+          skipped++;
+          continue;
+        }
+        if ( window )
+          follower.push( writer, (Note)block[i] );
+        else
+          counts[block[i]]++;
+      }
+      writer.flush();
+    }
+  } else {
+    string text;
+    text.reserve( g_transposeBlockSize );
+    ParseError error;
+    bool more = true;
+    while ( more )
+    {
+      text.clear();
+      do
+        more = appendLine( stdin, text );
+      while ( more && text.length() < g_transposeBlockSize );
+      size_t length = text.length();
+      for ( size_t i = 0; i < length; )
+      {
+        if ( isNoteSeparator( text[i] ) ) {
+          i++;
+          continue;
+        }
+        size_t end = i;
+        while ( end < length && !isNoteSeparator( text[end] ) )
+          end++;
+        Note note;
+        if ( !parseNote( StringView( text.data() + i, end - i ), note, error ) )
+          skipped++;
+        else if ( window )
+          follower.push( writer, note );
+        else
+          counts[note]++;
+        i = end;
+      }
+      writer.flush();
+    }
+  }
+  unsigned long long total = follower.size();
+  for ( int note = Note_C; note <= Note_B; note++ )
+    total += counts[note];
+  if ( !total )
+    writer.writeError( "No notes on standard input" );
+  else if ( window )
+    follower.finish( writer );
+  else {
+    float histogram[12];
+    for ( int note = Note_C; note <= Note_B; note++ )
+      histogram[note] = (float)counts[note];
+    KeyEstimateVector estimates;
+    estimateKeys( histogram, estimates );
+    writer.writeKey( "standard input", estimates, 3 );
+  }
+  writer.flush();
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu notes (%llu skipped) in %.3f seconds, %.0f notes/sec\n", total, skipped,
+    seconds, seconds > 0.0 ? (double)total / seconds : 0.0 );
+  return total ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool isMidiPath( const string& path )
+{
+  size_t dot = path.rfind( '.' );
+  if ( dot == string::npos )
+    return false;
+  return equalsNoCase( path.c_str() + dot, ".mid" ) || equalsNoCase( path.c_str() + dot, ".midi" );
+}
+
+int runMidi( const char* executable, OutputWriter& writer, size_t threads, int argc, char* argv[] )
+{
+  unsigned int beats = 1;
+  int first = 0;
+  if ( first < argc && startsWithNoCase( argv[first], "--window=" ) ) {
+    beats = (unsigned int)strtoul( argv[first] + 9, NULL, 10 );
+    first++;
+  }
+  if ( first >= argc || beats < 1 || beats > 64 ) {
+    printf( "Syntax: %s midi [--window=<beats>] <file|directory|->...\n", executable );
+    return EXIT_FAILURE;
+  }
+  writer.writeHeader();
+  writer.flush();
+
+  vector<MidiAnalyzer*> analyzers;
+  std::atomic<unsigned long long> failures( 0 );
+  unsigned long long files = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    OrderedRunner runner( writer.getFormat(), threads );
+    for ( size_t i = 0; i < runner.size(); i++ )
+      analyzers.push_back( new MidiAnalyzer() );
+    auto analyze = [&]( const string& path ) {
+      files++;
+      runner.submit( [&, path]( OutputWriter& output ) {
+        MidiAnalyzer& analyzer = *analyzers[ThreadPool::currentWorker()];
+        MappedFile file;
+        MidiAnalysis analysis;
+        if ( !file.open( path ) ) {
+          failures++;
+          output.writeError( "Could not open " + path );
+          return;
+        }
+        MidiResult result = analyzer.analyze( file.getData(), file.getSize(), beats, analysis );
+        if ( result != Midi_OK ) {
+          failures++;
+          output.writeError( "Could not analyze " + path + ": " + g_midiResultsStr[result] );
+          return;
+        }
+        output.writeMidi( path, analysis, beats );
+      } );
+    };
+    for ( int arg = first; arg < argc; arg++ )
+    {
+      string path;
+      DirectoryWalker walker;
+      if ( !strcmp( argv[arg], "-" ) ) {
+        while ( appendLine( stdin, path ) )
+        {
+          size_t end = path.find_last_not_of( "\r\n" );
+          path.resize( end == string::npos ? 0 : end + 1 );
+          if ( !path.empty() )
+            analyze( path );
+          path.clear();
+        }
+      } else if ( walker.open( argv[arg] ) ) {
+        while ( walker.next( path ) )
+          if ( isMidiPath( path ) )
+            analyze( path );
+      } else
+        analyze( argv[arg] );
+    }
+    runner.finish();
+  }
+  for ( size_t i = 0; i < analyzers.size(); i++ )
+    delete analyzers[i];
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu files (%llu failed) in %.3f seconds on %u threads, %.0f files/sec\n",
+    files, (unsigned long long)failures, seconds, (unsigned int)threads, seconds > 0.0 ? (double)files / seconds : 0.0 );
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Converts text progressions, one "<progression> <scale>" per line, into
+// a binary progression file
+
+int runPack( const char* executable, int argc, char* argv[] )
+{
+  if ( argc != 2 ) {
+    printf( "Syntax: %s pack <file|-> <output>\n", executable );
+    return EXIT_FAILURE;
+  }
+  FILE* input = stdin;
+  if ( strcmp( argv[0], "-" ) ) {
+    input = openFile( argv[0], "r" );
+    if ( !input ) {
+      fprintf( stderr, "Could not open %s\n", argv[0] );
+      return EXIT_FAILURE;
+    }
+  }
+  ProgressionFileWriter output;
+  if ( !output.open( argv[1] ) ) {
+    fprintf( stderr, "Could not create %s\n", argv[1] );
+    if ( input != stdin )
+      fclose( input );
+    return EXIT_FAILURE;
+  }
+  string line;
+  vector<const char*> args;
+  ChordProgression progression( Scale( Note_C, ScaleMode_Major ) );
+  unsigned long long lines = 0, progressions = 0, failures = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  while ( appendLine( input, line ) )
+  {
+    lines++;
+    splitQuery( &line[0], args );
+    if ( !args.empty() && args[0][0] != '#' ) {
+      Scale scale;
+      ParseError error;
+      const char* message = NULL;
+      if ( args.size() != 2 )
+        message = "expected a progression and a scale";
+      else if ( !parseScale( args[1], scale, error ) )
+        message = error.getString();
+      else {
+        progression = ChordProgression( scale );
+        if ( !progression.parse( args[0], error ) )
+          message = error.getString();
+        else if ( !output.add( progression ) )
+          message = "too many steps, or more scale modes than a file can hold";
+      }
+      if ( message ) {
+        failures++;
+        fprintf( stderr, "Invalid progression on line %llu: %s\n", lines, message );
+      } else
+        progressions++;
+    }
+    line.clear();
+  }
+  if ( input != stdin )
+    fclose( input );
+  if ( !output.close() ) {
+    fprintf( stderr, "Could not write %s\n", argv[1] );
+    return EXIT_FAILURE;
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu progressions (%llu invalid) in %.3f seconds, %.0f progressions/sec\n",
+    progressions, failures, seconds, seconds > 0.0 ? (double)progressions / seconds : 0.0 );
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Writes the progressions of a binary progression file back as text, or
+// with --count only decodes them, each block on its own thread
+
+int runUnpack( const char* executable, size_t threads, int argc, char* argv[] )
+{
+  bool count = argc == 2 && equalsNoCase( argv[1], "--count" );
+  if ( argc < 1 || argc > 2 || ( argc == 2 && !count ) ) {
+    printf( "Syntax: %s unpack <file> [--count]\n", executable );
+    return EXIT_FAILURE;
+  }
+  ProgressionFileReader file;
+  ProgressionFileResult result = file.open( argv[0] );
+  if ( result != ProgressionFile_OK ) {
+    fprintf( stderr, "Could not read %s: %s\n", argv[0], g_progressionFileResultsStr[result] );
+    return EXIT_FAILURE;
+  }
+  std::atomic<unsigned long long> chords( 0 ), bytes( 0 ), corrupt( 0 );
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    OrderedRunner runner( OutputFormat_Text, threads );
+    for ( size_t i = 0; i < file.getBlockCount(); i++ )
+    {
+      runner.submit( [&, i]( OutputWriter& output ) {
+        ProgressionCursor cursor = file.getBlock( i );
+        PackedProgression progression;
+        ChordProgressionStep step( Degree_Tonic, Triad() );
+        unsigned long long blockChords = 0;
+        string& buffer = output.getBuffer();
+        while ( cursor.next( progression ) )
+        {
+          if ( count ) {
+            const unsigned char* pos = progression.steps;
+            for ( const unsigned char* end = pos + progression.size; pos < end; blockChords++ )
+            {
+              decodeStep( progression.scale, pos, step );
+            }
+          } else {
+            appendPackedProgression( progression, buffer );
+            buffer.push_back( '\n' );
+          }
+        }
+        if ( cursor.isCorrupt() )
+          corrupt++;
+        chords += blockChords;
+        bytes += file.getBlockInfo( i ).size;
+      } );
+    }
+    runner.finish();
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  if ( corrupt ) {
+    fprintf( stderr, "Could not read %s: %s\n", argv[0], g_progressionFileResultsStr[ProgressionFile_Corrupt] );
+    return EXIT_FAILURE;
+  }
+  if ( count )
+    printf( "%llu progressions, %llu chords\n", file.getProgressions(), (unsigned long long)chords );
+  fprintf( stderr, "%llu progressions in %.3f seconds on %u threads, %.1f MB/sec\n", file.getProgressions(), seconds,
+    (unsigned int)threads, seconds > 0.0 ? (double)bytes / seconds / 1000000.0 : 0.0 );
+  return EXIT_SUCCESS;
+}
+
+// Builds the n-gram index of a binary progression file, written next to
+// it with .idx appended to the name
+
+int runIndex( const char* executable, size_t threads, int argc, char* argv[] )
+{
+  if ( argc != 1 ) {
+    printf( "Syntax: %s index <file>\n", executable );
+    return EXIT_FAILURE;
+  }
+  ProgressionFileReader file;
+  ProgressionFileResult result = file.open( argv[0] );
+  if ( result != ProgressionFile_OK ) {
+    fprintf( stderr, "Could not read %s: %s\n", argv[0], g_progressionFileResultsStr[result] );
+    return EXIT_FAILURE;
+  }
+  string path = string( argv[0] ) + ".idx";
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ProgressionIndexBuilder builder( file );
+  if ( !builder.build( threads ) ) {
+    fprintf( stderr, "Could not index %s: %s\n", argv[0], file.getProgressions() > 0xFFFFFFFFULL
+      ? "too many progressions" : g_progressionFileResultsStr[ProgressionFile_Corrupt] );
+    return EXIT_FAILURE;
+  }
+  if ( !builder.save( path ) ) {
+    fprintf( stderr, "Could not write %s\n", path.c_str() );
+    return EXIT_FAILURE;
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu progressions (%llu postings) in %.3f seconds on %u threads, %.0f progressions/sec\n",
+    file.getProgressions(), builder.getPostings(), seconds, (unsigned int)threads,
+    seconds > 0.0 ? (double)file.getProgressions() / seconds : 0.0 );
+  return EXIT_SUCCESS;
+}
+
+// Lists the progressions of an indexed file that contain a progression, in
+// any key, each with its number in the file
+
+int runFind( const char* executable, OutputWriter& writer, int argc, char* argv[] )
+{
+  const char* syntax = "Syntax: %s find <file> <progression> [scale] [--limit=<count>] [--count]\n";
+  const char* positional[3] = { NULL };
+  int positionals = 0;
+  size_t limit = 0;
+  bool count = false;
+  for ( int i = 0; i < argc; i++ )
+  {
+    if ( startsWithNoCase( argv[i], "--limit=" ) && strtoul( argv[i] + 8, NULL, 10 ) > 0 )
+      limit = strtoul( argv[i] + 8, NULL, 10 );
+    else if ( equalsNoCase( argv[i], "--count" ) )
+      count = true;
+    else if ( argv[i][0] != '-' && positionals < 3 )
+      positional[positionals++] = argv[i];
+    else
+      positionals = 4;
+  }
+  if ( positionals < 2 || positionals > 3 ) {
+    printf( syntax, executable );
+    return EXIT_FAILURE;
+  }
+  Scale scale( Note_C, ScaleMode_Major );
+  ParseError error;
+  if ( positional[2] && !parseScale( positional[2], scale, error ) ) {
+    fprintf( stderr, "Invalid scale %s: %s\n", positional[2], error.getString() );
+    return EXIT_FAILURE;
+  }
+  ChordProgression progression( scale );
+  if ( !progression.parse( positional[1], error ) ) {
+    fprintf( stderr, "Invalid progression %s: %s\n", positional[1], error.getString() );
+    return EXIT_FAILURE;
+  }
+  vector<Triad> query;
+  for ( size_t i = 0; i < progression.getSteps().size(); i++ )
+    query.push_back( progression.getSteps()[i].chord );
+  if ( query.size() < 2 ) {
+    fprintf( stderr, "Invalid progression %s: at least two chords are needed to search for\n", positional[1] );
+    return EXIT_FAILURE;
+  }
+  ProgressionFileReader file;
+  ProgressionFileResult fileResult = file.open( positional[0] );
+  if ( fileResult != ProgressionFile_OK ) {
+    fprintf( stderr, "Could not read %s: %s\n", positional[0], g_progressionFileResultsStr[fileResult] );
+    return EXIT_FAILURE;
+  }
+  string path = string( positional[0] ) + ".idx";
+  ProgressionIndexReader index;
+  ProgressionIndexResult indexResult = index.open( path, file );
+  if ( indexResult != ProgressionIndex_OK ) {
+    fprintf( stderr, "Could not read %s: %s\n", path.c_str(), g_progressionIndexResultsStr[indexResult] );
+    return EXIT_FAILURE;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  vector<unsigned int> matches;
+  unsigned long long candidates;
+  if ( !findRun( index, file, query, limit, matches, candidates ) ) {
+    fprintf( stderr, "Could not read %s: %s\n", path.c_str(), g_progressionIndexResultsStr[ProgressionIndex_Corrupt] );
+    return EXIT_FAILURE;
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  writer.writeHeader();
+  if ( count )
+    writer.writeFoundCount( matches.size() );
+  else {
+    PackedProgression found;
+    for ( size_t i = 0; i < matches.size(); i++ )
+    {
+      if ( !index.find( file, matches[i], found ) ) {
+        writer.flush();
+        fprintf( stderr, "Could not read %s: %s\n", positional[0], g_progressionFileResultsStr[ProgressionFile_Corrupt] );
+        return EXIT_FAILURE;
+      }
+      writer.writeFound( matches[i], found );
+    }
+  }
+  writer.flush();
+  fprintf( stderr, "%llu matches (%llu candidates) among %llu progressions in %.3f ms\n",
+    (unsigned long long)matches.size(), candidates, file.getProgressions(), seconds * 1000.0 );
+  return EXIT_SUCCESS;
+}
+
+// Trains a Markov model of the given order on the progressions of a
+// binary progression file
+
+int runTrain( const char* executable, size_t threads, int argc, char* argv[] )
+{
+  const char* syntax = "Syntax: %s train <file> <model> [--order=<1-3>]\n";
+  int order = 2;
+  if ( argc == 3 && startsWithNoCase( argv[2], "--order=" ) )
+    order = atoi( argv[2] + 8 );
+  if ( argc < 2 || argc > 3 || order < 1 || order > g_markovMaxOrder || ( argc == 3 && !startsWithNoCase( argv[2], "--order=" ) ) ) {
+    printf( syntax, executable );
+    return EXIT_FAILURE;
+  }
+  ProgressionFileReader file;
+  ProgressionFileResult result = file.open( argv[0] );
+  if ( result != ProgressionFile_OK ) {
+    fprintf( stderr, "Could not read %s: %s\n", argv[0], g_progressionFileResultsStr[result] );
+    return EXIT_FAILURE;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  MarkovModel model( order );
+  bool trained = file.getSteps() + file.getProgressions() <= 0xFFFFFFFFULL
+    ? trainMarkovModel<unsigned int>( file, threads, model )
+    : trainMarkovModel<unsigned long long>( file, threads, model );
+  if ( !trained ) {
+    fprintf( stderr, "Could not read %s: %s\n", argv[0], g_progressionFileResultsStr[ProgressionFile_Corrupt] );
+    return EXIT_FAILURE;
+  }
+  if ( !saveMarkovModel( model, file.getProgressions(), argv[1] ) ) {
+    fprintf( stderr, "Could not write %s\n", argv[1] );
+    return EXIT_FAILURE;
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu progressions in %.3f seconds on %u threads, %.0f progressions/sec\n",
+    file.getProgressions(), seconds, (unsigned int)threads, seconds > 0.0 ? (double)file.getProgressions() / seconds : 0.0 );
+  return EXIT_SUCCESS;
+}
+
+const size_t g_sampleChunkSize = 1 << 16;
+
+// Draws progressions in a scale from a trained model. Every chunk of them
+// has a random stream of its own, so a seed gives the same output on any
+// number of threads.
+
+int runSample( const char* executable, size_t threads, int argc, char* argv[] )
+{
+  const char* syntax = "Syntax: %s sample <model> <scale> <count> [--seed=<number>] [--max-length=<steps>]\n";
+  unsigned long long seed = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count();
+  size_t maxLength = 16;
+  char* end = NULL;
+  unsigned long long count = argc >= 3 ? strtoull( argv[2], &end, 10 ) : 0;
+  if ( argc < 3 || !argv[2][0] || *end ) {
+    printf( syntax, executable );
+    return EXIT_FAILURE;
+  }
+  for ( int i = 3; i < argc; i++ )
+  {
+    if ( startsWithNoCase( argv[i], "--seed=" ) )
+      seed = strtoull( argv[i] + 7, NULL, 10 );
+    else if ( startsWithNoCase( argv[i], "--max-length=" ) && atoi( argv[i] + 13 ) > 0 && atoi( argv[i] + 13 ) <= g_markovMaxLength )
+      maxLength = (size_t)atoi( argv[i] + 13 );
+    else {
+      printf( syntax, executable );
       return EXIT_FAILURE;
     }
-    DiatonicScale scale = scaleFromString( argv[2] );
-    scale.print();
   }
-  else if ( !_wcsicmp( argv[1], L"progression" ) )
+  MarkovModel model;
+  unsigned long long trained;
+  if ( !loadMarkovModel( argv[0], model, trained ) ) {
+    fprintf( stderr, "Could not read %s: not a progression model\n", argv[0] );
+    return EXIT_FAILURE;
+  }
+  Scale scale;
+  ParseError error;
+  if ( !parseScale( argv[1], scale, error ) ) {
+    fprintf( stderr, "Invalid scale %s: %s\n", argv[1], error.getString() );
+    return EXIT_FAILURE;
+  }
+  MarkovSampler sampler( model, scale );
+  if ( sampler.isEmpty() ) {
+    fprintf( stderr, "The model has no progressions that can be spelled in %s\n", scale.getName() );
+    return EXIT_FAILURE;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   {
-    if ( argc < 4 ) {
-      wprintf_s( L"Syntax: %s progression <progression> <scale>\r\n", argv[0] );
+    OrderedRunner runner( OutputFormat_Text, threads );
+    for ( unsigned long long first = 0; first < count; first += g_sampleChunkSize )
+    {
+      unsigned long long chunk = first / g_sampleChunkSize;
+      size_t size = (size_t)std::min( (unsigned long long)g_sampleChunkSize, count - first );
+      runner.submit( [&, chunk, size]( OutputWriter& output ) {
+        SplitMix random( SplitMix( seed + chunk ).next() );
+        unsigned char states[g_markovMaxLength];
+        string& buffer = output.getBuffer();
+        for ( size_t i = 0; i < size; i++ )
+        {
+          size_t length = sampler.sample( random, states, maxLength );
+          sampler.append( states, length, buffer );
+          buffer.push_back( '\n' );
+        }
+      } );
+    }
+    runner.finish();
+  }
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  fprintf( stderr, "%llu progressions in %.3f seconds on %u threads, %.0f progressions/sec (seed %llu)\n",
+    count, seconds, (unsigned int)threads, seconds > 0.0 ? (double)count / seconds : 0.0, seed );
+  return EXIT_SUCCESS;
+}
+
+#ifdef CHROMATIC_SERVE
+
+volatile sig_atomic_t g_serveStop = 0;
+
+void stopServing( int )
+{
+  g_serveStop = 1;
+}
+
+// Answers query lines on a Unix domain socket, each with the output of the
+// query followed by an empty line.
+
+int runServe( const char* executable, OutputFormat format, ResultCache* cache, int argc, char* argv[] )
+{
+  if ( argc != 1 ) {
+    printf( "Syntax: %s serve <socket>\n", executable );
+    return EXIT_FAILURE;
+  }
+  OutputWriter writer( format, NULL, 0 );
+  writer.setErrorStream( NULL );
+  string& buffer = writer.getBuffer();
+  string line, key;
+  vector<const char*> args;
+  UnixSocketServer server( [&]( const char* data, size_t length, string& output ) {
+    line.assign( data, length );
+    line.push_back( '\n' );
+    splitQuery( &line[0], args );
+    if ( !args.empty() && args[0][0] != '#' && findSyntax( args[0] ) && !isServedAction( args[0] ) )
+      writer.writeError( string( "Action " ) + args[0] + " is not available over serve" );
+    else if ( !args.empty() && args[0][0] != '#' ) {
+      switch ( runCachedQuery( writer, cache, args, key ) )
+      {
+        case Query_Syntax:
+          writer.writeError( string( "Syntax: " ) + findSyntax( args[0] ) );
+        break;
+        case Query_Unknown:
+          writer.writeError( string( "Unknown action " ) + args[0] );
+        break;
+        default:
+        break;
+      }
+    }
+    output.append( buffer );
+    output.push_back( '\n' );
+    buffer.clear();
+  } );
+  if ( !server.open( argv[0] ) ) {
+    fprintf( stderr, "Could not listen on %s: %s\n", argv[0], strerror( errno ) );
+    return EXIT_FAILURE;
+  }
+  signal( SIGINT, stopServing );
+  signal( SIGTERM, stopServing );
+  fprintf( stderr, "Serving on %s\n", argv[0] );
+  server.run( g_serveStop );
+  server.close();
+  fprintf( stderr, "%llu requests on %llu connections\n", server.getRequests(), server.getConnections() );
+  if ( cache )
+    printCacheSummary( *cache );
+  return EXIT_SUCCESS;
+}
+
+// Sends query lines from standard input to a server, keeping up to the
+// given number of them in flight, and writes the responses to standard
+// output with the latencies seen on standard error
+
+int runClient( const char* executable, int argc, char* argv[] )
+{
+  size_t depth = 1;
+  if ( argc == 2 && startsWithNoCase( argv[1], "--pipeline=" ) )
+    depth = strtoul( argv[1] + 11, NULL, 10 );
+  if ( argc < 1 || argc > 2 || ( argc == 2 && !startsWithNoCase( argv[1], "--pipeline=" ) ) || depth < 1 ) {
+    printf( "Syntax: %s client <socket> [--pipeline=<requests>]\n", executable );
+    return EXIT_FAILURE;
+  }
+  vector<string> queries;
+  char chunk[1024];
+  string query;
+  while ( fgets( chunk, sizeof( chunk ), stdin ) )
+  {
+    query.append( chunk );
+    if ( query[query.length() - 1] != '\n' && !feof( stdin ) )
+      continue;
+    if ( query[query.length() - 1] != '\n' )
+      query.push_back( '\n' );
+    queries.push_back( query );
+    query.clear();
+  }
+  UnixSocketClient client;
+  if ( !client.open( argv[0] ) ) {
+    fprintf( stderr, "Could not connect to %s: %s\n", argv[0], strerror( errno ) );
+    return EXIT_FAILURE;
+  }
+  typedef std::chrono::steady_clock Clock;
+  vector<Clock::time_point> sent( queries.size() );
+  vector<double> latencies;
+  latencies.reserve( queries.size() );
+  string input, requests;
+  size_t sending = 0, lineStart = 0, responseStart = 0;
+  Clock::time_point start = Clock::now();
+  while ( latencies.size() < queries.size() )
+  {
+    requests.clear();
+    size_t first = sending;
+    for ( ; sending < queries.size() && sending - latencies.size() < depth; sending++ )
+      requests.append( queries[sending] );
+    Clock::time_point now = Clock::now();
+    for ( size_t i = first; i < sending; i++ )
+      sent[i] = now;
+    if ( !requests.empty() && !client.send( requests.data(), requests.length() ) ) {
+      fprintf( stderr, "Lost connection to %s\n", argv[0] );
       return EXIT_FAILURE;
     }
-    DiatonicScale scale = scaleFromString( argv[3] );
-    wstring chords = argv[2];
-    ChordProgression progression( scale, chords );
-    progression.print();
-    return EXIT_SUCCESS;
-  } else {
-    wprintf_s( L"Syntax: %s <action>\r\n", argv[0] );
-    wprintf_s( L"Valid actions: chord, scale, progression\r\n" );
+    if ( !client.receive( input ) ) {
+      fprintf( stderr, "Lost connection to %s\n", argv[0] );
+      return EXIT_FAILURE;
+    }
+    now = Clock::now();
+    // A response ends at the first empty line
+    size_t newline;
+    while ( ( newline = input.find( '\n', lineStart ) ) != string::npos )
+    {
+      if ( newline == lineStart ) {
+        fwrite( input.data() + responseStart, 1, lineStart - responseStart, stdout );
+        latencies.push_back( std::chrono::duration<double>( now - sent[latencies.size()] ).count() );
+        responseStart = newline + 1;
+      }
+      lineStart = newline + 1;
+    }
+    input.erase( 0, responseStart );
+    lineStart -= responseStart;
+    responseStart = 0;
+  }
+  fflush( stdout );
+  double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+  std::sort( latencies.begin(), latencies.end() );
+  auto percentile = [&]( double fraction ) {
+    return latencies.empty() ? 0.0 : latencies[(size_t)( fraction * ( latencies.size() - 1 ) )] * 1000000.0;
+  };
+  fprintf( stderr, "%llu requests in %.3f seconds, %.0f requests/sec\n", (unsigned long long)latencies.size(),
+    seconds, seconds > 0.0 ? (double)latencies.size() / seconds : 0.0 );
+  fprintf( stderr, "Latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+    percentile( 0.5 ), percentile( 0.99 ), percentile( 0.999 ), percentile( 1.0 ) );
+  return EXIT_SUCCESS;
+}
+
+#endif
+
+bool parseOutputFormat( const char* str, OutputFormat& format )
+{
+  for ( int i = OutputFormat_Text; i <= OutputFormat_Csv; i++ )
+  {
+    if ( equalsNoCase( str, g_outputFormatsStr[i] ) ) {
+      format = (OutputFormat)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+int runCommandLine( int argc, char* argv[] )
+{
+  OutputFormat format = OutputFormat_Text;
+  size_t threads = ThreadPool::defaultSize();
+  size_t cacheEntries = 0;
+  const char* cachePath = NULL;
+  int arg = 1;
+  for ( ; arg < argc && !strncmp( argv[arg], "--", 2 ); arg++ )
+  {
+    if ( startsWithNoCase( argv[arg], "--format=" ) && parseOutputFormat( argv[arg] + 9, format ) )
+      continue;
+    if ( startsWithNoCase( argv[arg], "--scales=" ) ) {
+      if ( !loadScaleModes( argv[arg] + 9 ) )
+        return EXIT_FAILURE;
+      continue;
+    }
+    if ( startsWithNoCase( argv[arg], "--threads=" ) && strtoul( argv[arg] + 10, NULL, 10 ) > 0 ) {
+      threads = strtoul( argv[arg] + 10, NULL, 10 );
+      continue;
+    }
+    if ( startsWithNoCase( argv[arg], "--cache=" ) && strtoul( argv[arg] + 8, NULL, 10 ) > 0 ) {
+      cacheEntries = strtoul( argv[arg] + 8, NULL, 10 );
+      continue;
+    }
+    if ( startsWithNoCase( argv[arg], "--cache-file=" ) && argv[arg][13] ) {
+      cachePath = argv[arg] + 13;
+      continue;
+    }
+    if ( equalsNoCase( argv[arg], "--stats" ) || equalsNoCase( argv[arg], "--stats=text" ) || equalsNoCase( argv[arg], "--stats=json" ) ) {
+#ifdef CHROMATIC_STATS
+      g_statsJson = equalsNoCase( argv[arg], "--stats=json" );
+      atexit( printStatsAtExit );
+      continue;
+#else
+      fprintf( stderr, "%s needs a build with CHROMATIC_STATS defined\n", argv[arg] );
+      return EXIT_FAILURE;
+#endif
+    }
+    fprintf( stderr, "Unknown option %s\n", argv[arg] );
+    printUsage( argv[0] );
     return EXIT_FAILURE;
   }
-}
\ No newline at end of file
+  if ( arg >= argc ) {
+    printUsage( argv[0] );
+    return EXIT_FAILURE;
+  }
+  OutputWriter writer( format );
+  if ( equalsNoCase( argv[arg], "batch" ) || equalsNoCase( argv[arg], "serve" ) )
+  {
+    std::unique_ptr<ResultCache> cache;
+    unsigned long long cacheTag = scaleLibraryTag() ^ format;
+    if ( cacheEntries || cachePath ) {
+      cache.reset( new ResultCache( cacheEntries ? cacheEntries : g_cacheDefaultEntries ) );
+      if ( cachePath )
+        cache->load( cachePath, cacheTag );
+    }
+    int ret = EXIT_FAILURE;
+    if ( equalsNoCase( argv[arg], "serve" ) ) {
+#ifdef CHROMATIC_SERVE
+      ret = runServe( argv[0], format, cache.get(), argc - arg - 1, argv + arg + 1 );
+#else
+      fprintf( stderr, "%s is not supported on this platform\n", argv[arg] );
+#endif
+    } else if ( arg + 1 >= argc || !strcmp( argv[arg+1], "-" ) )
+      ret = runBatch( writer, stdin, threads, cache.get() );
+    else {
+      FILE* input = openFile( argv[arg+1], "r" );
+      if ( !input ) {
+        fprintf( stderr, "Could not open %s\n", argv[arg+1] );
+        return EXIT_FAILURE;
+      }
+      ret = runBatch( writer, input, threads, cache.get() );
+      fclose( input );
+    }
+    if ( cachePath && !cache->save( cachePath, cacheTag ) )
+      fprintf( stderr, "Could not save the cache to %s\n", cachePath );
+    return ret;
+  }
+  if ( equalsNoCase( argv[arg], "midi" ) )
+    return runMidi( argv[0], writer, threads, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "transpose" ) )
+    return runTranspose( argv[0], argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "pack" ) )
+    return runPack( argv[0], argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "unpack" ) )
+    return runUnpack( argv[0], threads, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "index" ) )
+    return runIndex( argv[0], threads, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "find" ) )
+    return runFind( argv[0], writer, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "train" ) )
+    return runTrain( argv[0], threads, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "sample" ) )
+    return runSample( argv[0], threads, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "key" ) && !strcmp( argv[argc-1], "-" ) )
+    return runKeyStream( argv[0], writer, argc - arg - 1, argv + arg + 1 );
+  if ( equalsNoCase( argv[arg], "client" ) )
+  {
+#ifdef CHROMATIC_SERVE
+    return runClient( argv[0], argc - arg - 1, argv + arg + 1 );
+#else
+    fprintf( stderr, "%s is not supported on this platform\n", argv[arg] );
+    return EXIT_FAILURE;
+#endif
+  }
+  writer.writeHeader();
+  switch ( runQuery( writer, argv[arg], argc - arg - 1, argv + arg + 1, threads ) )
+  {
+    case Query_OK:
+      return EXIT_SUCCESS;
+    case Query_Syntax:
+      printSyntax( argv[0], argv[arg] );
+    break;
+    case Query_Unknown:
+      printUsage( argv[0] );
+    break;
+    case Query_Invalid:
+    break;
+  }
+  return EXIT_FAILURE;
+}
+
+#ifdef _WIN32
+
+// Windows passes the arguments in UTF-16; they are converted to UTF-8, and
+// the console is told to expect UTF-8 output
+
+int wmain( int argc, wchar_t* argv[] )
+{
+  vector<string> args( argc );
+  vector<char*> pointers( argc + 1, (char*)NULL );
+  for ( int i = 0; i < argc; i++ )
+  {
+    args[i] = narrowUtf8( argv[i] );
+    pointers[i] = &args[i][0];
+  }
+  SetConsoleOutputCP( CP_UTF8 );
+  return runCommandLine( argc, &pointers[0] );
+}
+
+#else
+
+int main( int argc, char* argv[] )
+{
+  return runCommandLine( argc, argv );
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdlib>
+#include <new>
+
+#include "chromaticAllocations.h"
+
+// Replaces every usual form of the global allocation functions, so that all
+// heap allocations are counted and all of them are released with free. The
+// replacements live in their own translation unit so that the compiler never
+// inlines them into callers and pairs one call site's malloc with another's
+// free.
+
+namespace chromatic {
+
+  thread_local unsigned long long t_allocations = 0;
+  std::atomic<unsigned long long> g_allocations( 0 );
+
+}
+
+void* operator new( std::size_t size )
+{
+  chromatic::t_allocations++;
+  chromatic::g_allocations.fetch_add( 1, std::memory_order_relaxed );
+  void* p = malloc( size ? size : 1 );
+  if ( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[]( std::size_t size )
+{
+  return operator new( size );
+}
+
+void* operator new( std::size_t size, const std::nothrow_t& ) throw()
+{
+  try
+  {
+    return operator new( size );
+  }
+  catch ( std::bad_alloc& )
+  {
+    return NULL;
+  }
+}
+
+void* operator new[]( std::size_t size, const std::nothrow_t& ) throw()
+{
+  return operator new( size, std::nothrow );
+}
+
+void operator delete( void* p ) throw()
+{
+  free( p );
+}
+
+void operator delete[]( void* p ) throw()
+{
+  free( p );
+}
+
+void operator delete( void* p, const std::nothrow_t& ) throw()
+{
+  free( p );
+}
+
+void operator delete[]( void* p, const std::nothrow_t& ) throw()
+{
+  free( p );
+}
+
+void operator delete( void* p, std::size_t ) throw()
+{
+  free( p );
+}
+
+void operator delete[]( void* p, std::size_t ) throw()
+{
+  free( p );
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+
+// Heap allocation counters, kept by the replacement allocation functions
+// in chromaticAllocations.cpp. Only programs that link that file count
+// allocations: chromaticbench, and chromatic built with CHROMATIC_STATS.
+
+namespace chromatic {
+
+  // Allocations made on this thread, and in all threads
+  extern thread_local unsigned long long t_allocations;
+  extern std::atomic<unsigned long long> g_allocations;
+
+}
\ No newline at end of file
@@ -0,0 +1,219 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define CHROMATIC_BUILDING_LIBRARY
+#include "chromaticApi.h"
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticParser.h"
+#include "chromaticChordProgression.h"
+
+using namespace chromatic;
+
+namespace {
+
+  bool inputView( const char* str, size_t length, StringView& view )
+  {
+    if ( !str && length )
+      return false;
+    view = StringView( str, length );
+    return true;
+  }
+
+  chromatic_status parseFailed( const ParseError& parseError, chromatic_error* error )
+  {
+    if ( error ) {
+      error->code = parseError.result;
+      error->position = parseError.position;
+    }
+    return CHROMATIC_ERROR_PARSE;
+  }
+
+  bool validScale( chromatic_scale scale )
+  {
+    return scale.root <= Note_B && scale.mode < g_scales.size();
+  }
+
+  void exportChord( const Triad& triad, chromatic_chord* chord )
+  {
+    chord->notes[0] = triad.first;
+    chord->notes[1] = triad.second;
+    chord->notes[2] = triad.third;
+    chord->type = triad.type;
+  }
+
+  // Copies strings into a caller's buffer, counting what did not fit
+  class OutputBuffer {
+  protected:
+    char* buffer;
+    size_t size;
+    size_t length;
+  public:
+    OutputBuffer( char* _buffer, size_t _size ): buffer( _buffer ), size( _buffer ? _size : 0 ), length( 0 )
+    {
+    }
+    void put( const char* str )
+    {
+      for ( ; *str; str++, length++ )
+        if ( length + 1 < size )
+          buffer[length] = *str;
+    }
+    chromatic_status finish( size_t* _length )
+    {
+      if ( size )
+        buffer[length < size ? length : size - 1] = '\0';
+      if ( _length )
+        *_length = length;
+      return length < size ? CHROMATIC_OK : CHROMATIC_ERROR_BUFFER;
+    }
+  };
+
+}
+
+unsigned int chromatic_api_version( void )
+{
+  return CHROMATIC_API_VERSION;
+}
+
+chromatic_status chromatic_parse_chord( const char* str, size_t length, chromatic_chord* chord, chromatic_error* error )
+{
+  StringView view;
+  if ( !chord || !inputView( str, length, view ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Triad triad;
+  ParseError parseError;
+  if ( !parseChord( view, triad, parseError ) )
+    return parseFailed( parseError, error );
+  exportChord( triad, chord );
+  return CHROMATIC_OK;
+}
+
+chromatic_status chromatic_parse_scale( const char* str, size_t length, chromatic_scale* scale, chromatic_error* error )
+{
+  StringView view;
+  if ( !scale || !inputView( str, length, view ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Scale parsed;
+  ParseError parseError;
+  if ( !parseScale( view, parsed, parseError ) )
+    return parseFailed( parseError, error );
+  scale->root = parsed.getRoot();
+  scale->mode = parsed.getMode();
+  return CHROMATIC_OK;
+}
+
+chromatic_status chromatic_scale_degrees( chromatic_scale scale, int* count )
+{
+  if ( !count || !validScale( scale ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  *count = Scale( (Note)scale.root, (ScaleMode)scale.mode ).getDegreeCount();
+  return CHROMATIC_OK;
+}
+
+chromatic_status chromatic_scale_triad( chromatic_scale scale, int degree, chromatic_chord* chord )
+{
+  if ( !chord || !validScale( scale ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Scale resolved( (Note)scale.root, (ScaleMode)scale.mode );
+  if ( degree < 0 || degree >= resolved.getDegreeCount() )
+    return CHROMATIC_ERROR_ARGUMENT;
+  if ( !resolved.hasTriad( (Degree)degree ) )
+    return CHROMATIC_ERROR_NO_TRIAD;
+  exportChord( resolved.getTriad( (Degree)degree ), chord );
+  return CHROMATIC_OK;
+}
+
+chromatic_status chromatic_resolve_progression( const char* str, size_t length, chromatic_scale scale,
+  chromatic_chord* chords, size_t capacity, size_t* count, chromatic_error* error )
+{
+  StringView view;
+  if ( !count || ( !chords && capacity ) || !validScale( scale ) || !inputView( str, length, view ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Scale resolved( (Note)scale.root, (ScaleMode)scale.mode );
+  Tokenizer tokenizer( view, '-' );
+  StringView token;
+  size_t position;
+  ParseError parseError;
+  ChordProgressionStep step( Degree_Tonic, Triad() );
+  size_t steps = 0;
+  while ( tokenizer.next( token, position ) )
+  {
+    if ( !parseStep( token, position, resolved, step, parseError ) )
+      return parseFailed( parseError, error );
+    if ( steps < capacity )
+      exportChord( step.chord, &chords[steps] );
+    steps++;
+  }
+  *count = steps;
+  return steps <= capacity ? CHROMATIC_OK : CHROMATIC_ERROR_BUFFER;
+}
+
+chromatic_status chromatic_format_chord( const chromatic_chord* chord, chromatic_format format,
+  char* buffer, size_t size, size_t* length )
+{
+  if ( !chord || chord->notes[0] > Note_B || chord->type > ChordType_SuspendedSecond )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Triad triad( (Note)chord->notes[0], (ChordType)chord->type );
+  OutputBuffer output( buffer, size );
+  if ( format == CHROMATIC_FORMAT_NAME )
+    output.put( triad.getName() );
+  else if ( format == CHROMATIC_FORMAT_NOTES )
+    output.put( triad.getString() );
+  else
+    return CHROMATIC_ERROR_ARGUMENT;
+  return output.finish( length );
+}
+
+chromatic_status chromatic_format_scale( chromatic_scale scale, chromatic_format format,
+  char* buffer, size_t size, size_t* length )
+{
+  if ( !validScale( scale ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Scale resolved( (Note)scale.root, (ScaleMode)scale.mode );
+  OutputBuffer output( buffer, size );
+  if ( format == CHROMATIC_FORMAT_NAME )
+    output.put( resolved.getName() );
+  else if ( format == CHROMATIC_FORMAT_NOTES )
+    output.put( resolved.getString() );
+  else
+    return CHROMATIC_ERROR_ARGUMENT;
+  return output.finish( length );
+}
+
+chromatic_status chromatic_format_degree( chromatic_scale scale, int degree, char* buffer, size_t size, size_t* length )
+{
+  if ( !validScale( scale ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  Scale resolved( (Note)scale.root, (ScaleMode)scale.mode );
+  if ( degree < 0 || degree >= resolved.getDegreeCount() )
+    return CHROMATIC_ERROR_ARGUMENT;
+  OutputBuffer output( buffer, size );
+  output.put( resolved.getDegree( (Degree)degree ) );
+  return output.finish( length );
+}
+
+chromatic_status chromatic_format_error( const chromatic_error* error, char* buffer, size_t size, size_t* length )
+{
+  if ( !error || error->code < Parse_OK
+    || (size_t)error->code >= sizeof( g_parseResultsStr ) / sizeof( g_parseResultsStr[0] ) )
+    return CHROMATIC_ERROR_ARGUMENT;
+  OutputBuffer output( buffer, size );
+  output.put( g_parseResultsStr[error->code] );
+  return output.finish( length );
+}
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*
+ * Chromatic musical utility
+ * Copyright (c) 2012 noorus
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * C interface to chromatic, built as the chromatic shared and static
+ * libraries. Strings are UTF-8, with an explicit length so that they need
+ * not be terminated. No function allocates memory or does I/O, and all of
+ * them may be called from any number of threads at once.
+ *
+ * Link the static library with CHROMATIC_STATIC defined.
+ */
+
+#include <stddef.h>
+
+#if defined( CHROMATIC_STATIC )
+#define CHROMATIC_EXPORT
+#elif defined( _WIN32 )
+#ifdef CHROMATIC_BUILDING_LIBRARY
+#define CHROMATIC_EXPORT __declspec( dllexport )
+#else
+#define CHROMATIC_EXPORT __declspec( dllimport )
+#endif
+#elif defined( __GNUC__ )
+#define CHROMATIC_EXPORT __attribute__( ( visibility( "default" ) ) )
+#else
+#define CHROMATIC_EXPORT
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Changes only when existing functions or structures change */
+#define CHROMATIC_API_VERSION 1
+
+typedef enum chromatic_status {
+  CHROMATIC_OK = 0,
+  /* The input could not be parsed, see the chromatic_error */
+  CHROMATIC_ERROR_PARSE = 1,
+  /* The output did not fit, and was truncated */
+  CHROMATIC_ERROR_BUFFER = 2,
+  /* A NULL pointer, or a note, chord type, mode or degree out of range */
+  CHROMATIC_ERROR_ARGUMENT = 3,
+  /* The degree of the scale has no triad made of notes of the scale */
+  CHROMATIC_ERROR_NO_TRIAD = 4
+} chromatic_status;
+
+typedef enum chromatic_format {
+  /* "C Minor", or "F# Dorian" for scales */
+  CHROMATIC_FORMAT_NAME = 0,
+  /* "C-D#-G", the notes with sharps */
+  CHROMATIC_FORMAT_NOTES = 1
+} chromatic_format;
+
+/* Notes are 0 for C up to 11 for B. Chord types are 0 major, 1 minor,
+   2 augmented, 3 diminished, 4 suspended fourth and 5 suspended second. */
+typedef struct chromatic_chord {
+  unsigned char notes[3];
+  unsigned char type;
+} chromatic_chord;
+
+/* Modes are 0 minor, 1 major, then dorian, phrygian, lydian, mixolydian,
+   locrian, harmonic minor, melodic minor, major pentatonic, minor
+   pentatonic and blues. */
+typedef struct chromatic_scale {
+  unsigned char root;
+  unsigned char mode;
+} chromatic_scale;
+
+/* Why and where parsing failed, position counting bytes from 0 */
+typedef struct chromatic_error {
+  int code;
+  size_t position;
+} chromatic_error;
+
+CHROMATIC_EXPORT unsigned int chromatic_api_version( void );
+
+/* Parses chord shorthand such as "Cm" or "G#sus2" */
+CHROMATIC_EXPORT chromatic_status chromatic_parse_chord( const char* str, size_t length,
+  chromatic_chord* chord, chromatic_error* error );
+
+/* Parses scale shorthand such as "F#m" or "D:dorian" */
+CHROMATIC_EXPORT chromatic_status chromatic_parse_scale( const char* str, size_t length,
+  chromatic_scale* scale, chromatic_error* error );
+
+/* Number of notes in a scale, seven for the diatonic modes */
+CHROMATIC_EXPORT chromatic_status chromatic_scale_degrees( chromatic_scale scale, int* count );
+
+/* Triad built on a degree of a scale, counting from 0 for the tonic */
+CHROMATIC_EXPORT chromatic_status chromatic_scale_triad( chromatic_scale scale, int degree,
+  chromatic_chord* chord );
+
+/* Resolves roman numerals such as "i-VI-iv-v" or "I-V/V-bVII-V64" to the
+   triads of a scale, in root position.
+   On success count is the number of chords, and if the chords did not
+   fit, CHROMATIC_ERROR_BUFFER is returned with the number needed. */
+CHROMATIC_EXPORT chromatic_status chromatic_resolve_progression( const char* str, size_t length,
+  chromatic_scale scale, chromatic_chord* chords, size_t capacity, size_t* count, chromatic_error* error );
+
+/* Formatting functions terminate the buffer whenever size is not zero.
+   length is set to the length of the whole string, without terminator,
+   even when it was truncated; it may be NULL. */
+
+CHROMATIC_EXPORT chromatic_status chromatic_format_chord( const chromatic_chord* chord, chromatic_format format,
+  char* buffer, size_t size, size_t* length );
+
+CHROMATIC_EXPORT chromatic_status chromatic_format_scale( chromatic_scale scale, chromatic_format format,
+  char* buffer, size_t size, size_t* length );
+
+/* Roman numeral of a degree of a scale, "VI" or "iv" */
+CHROMATIC_EXPORT chromatic_status chromatic_format_degree( chromatic_scale scale, int degree,
+  char* buffer, size_t size, size_t* length );
+
+/* Message describing a parse error */
+CHROMATIC_EXPORT chromatic_status chromatic_format_error( const chromatic_error* error,
+  char* buffer, size_t size, size_t* length );
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,243 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#include "chromaticScales.h"
+#include "chromaticFiles.h"
+
+namespace chromatic {
+
+  using std::string;
+  using std::vector;
+
+  // Results longer than this are not worth the memory of keeping them
+  const size_t g_cacheMaxResult = 1 << 14;
+
+  const size_t g_cacheShards = 16;
+
+  // Caches are split into shards only as far as each shard keeps this many
+  // entries, so that small caches are one exact LRU list
+  const size_t g_cacheShardMinEntries = 256;
+
+  const size_t g_cacheDefaultEntries = 1 << 16;
+
+  const char g_cacheMagic[4] = { 'C', 'H', 'R', 'C' };
+
+  // Bumped whenever the formatting of any cached result changes
+  const unsigned int g_cacheVersion = 2;
+
+  // Header of a saved cache, followed by entries of a key length, a result
+  // length and the UTF-8 bytes of both, least recently used first
+  struct CacheFileHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int charSize;
+    unsigned int reserved;
+    unsigned long long tag;
+    unsigned long long entries;
+  };
+
+  // Identifies the scale modes that results were formatted with, so that a
+  // cache saved with other --scales files is not used
+  inline unsigned long long scaleLibraryTag()
+  {
+    unsigned long long hash = 14695981039346656037ULL;
+    auto mix = [&hash]( unsigned long long value ) {
+      hash = ( hash ^ value ) * 1099511628211ULL;
+    };
+    for ( int i = 0; i < g_scales.size(); i++ )
+    {
+      const ScaleModeInfo& mode = g_scales.getMode( (ScaleMode)i );
+      for ( size_t j = 0; j < mode.key.length(); j++ )
+        mix( mode.key[j] );
+      for ( size_t j = 0; j < mode.name.length(); j++ )
+        mix( mode.name[j] );
+      mix( mode.pattern );
+    }
+    return hash;
+  }
+
+  // Bounded cache of formatted query results keyed on the normalized query,
+  // least recently used results evicted first. Split into shards with locks
+  // of their own, so that batch threads rarely wait for each other.
+
+  class ResultCache {
+  protected:
+    struct Entry {
+      string key;
+      string result;
+    };
+    typedef std::list<Entry> EntryList;
+    struct Shard {
+      std::mutex lock;
+      size_t capacity;
+      EntryList entries;
+      std::unordered_map<string, EntryList::iterator> index;
+    };
+    Shard shards[g_cacheShards];
+    size_t shardCount;
+    std::atomic<unsigned long long> hits;
+    std::atomic<unsigned long long> misses;
+    std::atomic<unsigned long long> evictions;
+    ResultCache( const ResultCache& );
+    ResultCache& operator=( const ResultCache& );
+    Shard& getShard( const string& key )
+    {
+      return shards[std::hash<string>()( key ) % shardCount];
+    }
+  public:
+    // Holds at most the given number of results, split between the shards
+    explicit ResultCache( size_t capacity ): hits( 0 ), misses( 0 ), evictions( 0 )
+    {
+      capacity = std::max( capacity, (size_t)1 );
+      shardCount = std::min( std::max( capacity / g_cacheShardMinEntries, (size_t)1 ), g_cacheShards );
+      for ( size_t i = 0; i < shardCount; i++ )
+        shards[i].capacity = capacity / shardCount + ( i < capacity % shardCount ? 1 : 0 );
+    }
+    // Appends the cached result for the key to the output
+    bool find( const string& key, string& output )
+    {
+      Shard& shard = getShard( key );
+      std::lock_guard<std::mutex> lock( shard.lock );
+      auto it = shard.index.find( key );
+      if ( it == shard.index.end() ) {
+        misses++;
+        return false;
+      }
+      shard.entries.splice( shard.entries.begin(), shard.entries, it->second );
+      output.append( it->second->result );
+      hits++;
+      return true;
+    }
+    void insert( const string& key, const char* result, size_t length )
+    {
+      if ( length > g_cacheMaxResult )
+        return;
+      Shard& shard = getShard( key );
+      std::lock_guard<std::mutex> lock( shard.lock );
+      auto it = shard.index.find( key );
+      if ( it != shard.index.end() ) {
+        shard.entries.splice( shard.entries.begin(), shard.entries, it->second );
+        it->second->result.assign( result, length );
+        return;
+      }
+      if ( shard.index.size() >= shard.capacity ) {
+        shard.index.erase( shard.entries.back().key );
+        shard.entries.pop_back();
+        evictions++;
+      }
+      shard.entries.push_front( Entry() );
+      shard.entries.front().key = key;
+      shard.entries.front().result.assign( result, length );
+      shard.index[key] = shard.entries.begin();
+    }
+    // Loads a saved cache, mapping the file rather than reading it. Files
+    // saved with another tag or by another build are ignored.
+    bool load( const string& path, unsigned long long tag )
+    {
+      MappedFile file;
+      if ( !file.open( path ) || file.getSize() < sizeof( CacheFileHeader ) )
+        return false;
+      CacheFileHeader header;
+      memcpy( &header, file.getData(), sizeof( header ) );
+      if ( memcmp( header.magic, g_cacheMagic, 4 ) || header.version != g_cacheVersion
+        || header.charSize != sizeof( char ) || header.tag != tag )
+        return false;
+      const unsigned char* data = file.getData() + sizeof( header );
+      const unsigned char* end = file.getData() + file.getSize();
+      string key;
+      vector<char> result;
+      for ( unsigned long long i = 0; i < header.entries; i++ )
+      {
+        unsigned int lengths[2];
+        if ( (size_t)( end - data ) < sizeof( lengths ) )
+          return false;
+        memcpy( lengths, data, sizeof( lengths ) );
+        data += sizeof( lengths );
+        if ( lengths[1] > g_cacheMaxResult || (size_t)( end - data ) < (size_t)lengths[0] + lengths[1] )
+          return false;
+        key.resize( lengths[0] );
+        result.resize( lengths[1] + 1 );
+        memcpy( &key[0], data, lengths[0] );
+        data += lengths[0];
+        memcpy( &result[0], data, lengths[1] );
+        data += lengths[1];
+        insert( key, &result[0], lengths[1] );
+      }
+      return true;
+    }
+    bool save( const string& path, unsigned long long tag )
+    {
+      CacheFileHeader header;
+      memset( &header, 0, sizeof( header ) );
+      memcpy( header.magic, g_cacheMagic, 4 );
+      header.version = g_cacheVersion;
+      header.charSize = sizeof( char );
+      header.tag = tag;
+      header.entries = size();
+      return saveFile( path, [&]( FILE* file ) {
+        bool written = fwrite( &header, sizeof( header ), 1, file ) == 1;
+        for ( size_t i = 0; i < shardCount && written; i++ )
+        {
+          std::lock_guard<std::mutex> lock( shards[i].lock );
+          for ( EntryList::reverse_iterator it = shards[i].entries.rbegin(); it != shards[i].entries.rend() && written; ++it )
+          {
+            unsigned int lengths[2] = { (unsigned int)it->key.length(), (unsigned int)it->result.length() };
+            written = fwrite( lengths, sizeof( lengths ), 1, file ) == 1
+              && fwrite( it->key.data(), sizeof( char ), lengths[0], file ) == lengths[0]
+              && fwrite( it->result.data(), sizeof( char ), lengths[1], file ) == lengths[1];
+          }
+        }
+        return written;
+      } );
+    }
+    size_t size()
+    {
+      size_t count = 0;
+      for ( size_t i = 0; i < shardCount; i++ )
+      {
+        std::lock_guard<std::mutex> lock( shards[i].lock );
+        count += shards[i].index.size();
+      }
+      return count;
+    }
+    unsigned long long getHits() const
+    {
+      return hits;
+    }
+    unsigned long long getMisses() const
+    {
+      return misses;
+    }
+    unsigned long long getEvictions() const
+    {
+      return evictions;
+    }
+  };
+
+}
\ No newline at end of file
@@ -17,95 +17,454 @@
 
 #pragma once
 
+#include <cstring>
 #include <string>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
-#include <boost/tokenizer.hpp>
 
 #include "chromaticTypes.h"
 #include "chromaticChords.h"
 #include "chromaticScales.h"
+#include "chromaticParser.h"
+#include "chromaticPitchClassSet.h"
 
 namespace chromatic {
 
-  using std::wstring;
+  using std::string;
   using std::vector;
 
+  // Sharp or flat before a numeral, moving it off the major scale
+
+  enum Accidental: signed char {
+    Accidental_Flat = -1,
+    Accidental_None = 0,
+    Accidental_Sharp = 1
+  };
+
+  // Chord quality written after a numeral. Without one, a step takes its
+  // chord from the scale, or if it is borrowed or applied, from the case
+  // of the numeral: major in uppercase, minor in lowercase and diminished
+  // for a lowercase vii.
+
+  enum StepQuality: unsigned char {
+    StepQuality_Implied = 0,
+    StepQuality_Diminished,
+    StepQuality_Augmented,
+    StepQuality_SuspendedFourth,
+    StepQuality_SuspendedSecond
+  };
+
+  const char* g_stepQualitiesStr[5] = {
+    "", "o", "+", "sus4", "sus2"
+  };
+
+  const ChordType g_stepQualityChords[5] = {
+    ChordType_Major, ChordType_Diminished, ChordType_Augmented, ChordType_SuspendedFourth, ChordType_SuspendedSecond
+  };
+
+  const char* g_inversionFiguresStr[3] = {
+    "", "6", "64"
+  };
+
+  // A numeral as written, with its accidental and case
+
+  struct StepNumeral {
+    Degree degree;
+    Accidental accidental;
+    bool upper;
+  };
+
+  // One chord of a progression. Plain steps are a bare numeral naming a
+  // degree of the scale; the rest may be borrowed from the parallel major
+  // (bVI), applied to another degree (V/V), have their quality given (IV+)
+  // or be inverted (V6, I64).
+
   struct ChordProgressionStep {
-    wstring str;
+    Degree degree;
     Triad chord;
-    ChordProgressionStep( const wstring& _str, Triad _chord ):
-    str( _str ), chord( _chord ) {}
+    StepNumeral numeral;
+    StepNumeral target;
+    StepQuality quality;
+    bool applied;
+    Inversion inversion;
+    ChordProgressionStep( Degree _degree, const Triad& _chord ):
+    degree( _degree ), chord( _chord ), quality( StepQuality_Implied ), applied( false ), inversion( Inversion_Root )
+    {
+      numeral.degree = target.degree = _degree;
+      numeral.accidental = target.accidental = Accidental_None;
+      numeral.upper = target.upper = true;
+    }
+    bool isPlain() const
+    {
+      return !numeral.accidental && !quality && !applied && inversion == Inversion_Root;
+    }
+    // Chord notes from the bass up
+    void getVoicedNotes( Note notes[3] ) const
+    {
+      Note root[3] = { chord.first, chord.second, chord.third };
+      for ( int i = 0; i < 3; i++ )
+        notes[i] = root[( i + inversion ) % 3];
+    }
   };
 
   typedef vector<ChordProgressionStep> ProgressionVector;
 
-  typedef vector<wstring> StringVector;
-  typedef boost::char_separator<wchar_t,wstring::traits_type> CharSeparator;
-  typedef boost::tokenizer<CharSeparator,wstring::const_iterator,wstring> CharTokenizer;
+  // Splits a string on a single delimiter, returning views into the
+  // original string along with their positions. Empty tokens are kept.
+
+  class Tokenizer {
+  protected:
+    StringView str;
+    char delimiter;
+    size_t pos;
+  public:
+    Tokenizer( const StringView& _str, char _delimiter ):
+    str( _str ), delimiter( _delimiter ), pos( 0 ) {}
+    bool next( StringView& token, size_t& position )
+    {
+      if ( pos > str.length() )
+        return false;
+      size_t end = str.find( delimiter, pos );
+      if ( end == StringView::npos )
+        end = str.length();
+      token = str.substr( pos, end - pos );
+      position = pos;
+      pos = end + 1;
+      return true;
+    }
+  };
+
+  // Roman numerals from i to vii keyed by their letters as base 3 digits,
+  // i = 1 and v = 2, first letter in the lowest digit. -1 for non-numerals.
+
+  const int g_numeralDegrees[27] = {
+    -1, Degree_Tonic, Degree_Dominant, -1, Degree_Supertonic, Degree_Submediant, -1, Degree_Subdominant, -1,
+    -1, -1, -1, -1, Degree_Mediant, Degree_Subsemitone, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1
+  };
 
-  void explode( const wstring& str, wstring delims, StringVector& v )
+  inline bool parseNumeral( const StringView& str, Degree& degree )
   {
-    CharSeparator sep( delims.c_str() );
-    CharTokenizer tokenizer( str, sep );
-    for ( CharTokenizer::iterator it = tokenizer.begin(); it != tokenizer.end(); ++it )
+    if ( str.empty() || str.length() > 3 )
+      return false;
+    int key = 0;
+    for ( size_t i = 0, digit = 1; i < str.length(); i++, digit *= 3 )
+    {
+      char c = lowerAscii( str[i] );
+      if ( c == 'i' )
+        key += (int)digit;
+      else if ( c == 'v' )
+        key += 2 * (int)digit;
+      else
+        return false;
+    }
+    if ( g_numeralDegrees[key] < 0 )
+      return false;
+    degree = (Degree)g_numeralDegrees[key];
+    return true;
+  }
+
+  // Semitones above the tonic of each degree of the major scale, which
+  // accidentals and applied chords are measured from
+
+  const Semitones g_majorDegreeOffsets[7] = { 0, 2, 4, 5, 7, 9, 11 };
+
+  // Progression steps are read by a state machine over character classes,
+  // so that the full grammar costs one table lookup per character:
+  //   [b|#] numeral [o|+|sus4|sus2] [6|64] [/ [b|#] numeral]
+
+  enum StepState: unsigned char {
+    StepState_Error = 0,
+    StepState_Start,
+    StepState_Accidental,
+    StepState_Numeral,
+    StepState_S,
+    StepState_Su,
+    StepState_Sus,
+    StepState_Quality,
+    StepState_Sixth,
+    StepState_SixFour,
+    StepState_Slash,
+    StepState_TargetAccidental,
+    StepState_TargetNumeral
+  };
+
+  enum StepClass: unsigned char {
+    StepClass_Other = 0,
+    StepClass_Flat,
+    StepClass_Sharp,
+    StepClass_Numeral,
+    StepClass_Diminished,
+    StepClass_Augmented,
+    StepClass_S,
+    StepClass_U,
+    StepClass_Two,
+    StepClass_Four,
+    StepClass_Six,
+    StepClass_Slash
+  };
+
+  class StepTable {
+  public:
+    StepClass classes[128];
+    StepState transitions[13][12];
+    StepTable()
     {
-      v.push_back( *it );
+      memset( classes, StepClass_Other, sizeof( classes ) );
+      memset( transitions, StepState_Error, sizeof( transitions ) );
+      classes['b'] = StepClass_Flat;
+      classes['#'] = StepClass_Sharp;
+      classes['i'] = classes['I'] = classes['v'] = classes['V'] = StepClass_Numeral;
+      classes['o'] = classes['O'] = StepClass_Diminished;
+      classes['+'] = StepClass_Augmented;
+      classes['s'] = classes['S'] = StepClass_S;
+      classes['u'] = classes['U'] = StepClass_U;
+      classes['2'] = StepClass_Two;
+      classes['4'] = StepClass_Four;
+      classes['6'] = StepClass_Six;
+      classes['/'] = StepClass_Slash;
+      StepState numerals[2][2] = {
+        { StepState_Start, StepState_Accidental },
+        { StepState_Slash, StepState_TargetAccidental }
+      };
+      for ( int i = 0; i < 2; i++ )
+      {
+        transitions[numerals[i][0]][StepClass_Flat] = numerals[i][1];
+        transitions[numerals[i][0]][StepClass_Sharp] = numerals[i][1];
+        StepState numeral = (StepState)( numerals[i][1] + 1 );
+        transitions[numerals[i][0]][StepClass_Numeral] = numeral;
+        transitions[numerals[i][1]][StepClass_Numeral] = numeral;
+        transitions[numeral][StepClass_Numeral] = numeral;
+      }
+      transitions[StepState_Numeral][StepClass_Diminished] = StepState_Quality;
+      transitions[StepState_Numeral][StepClass_Augmented] = StepState_Quality;
+      transitions[StepState_Numeral][StepClass_S] = StepState_S;
+      transitions[StepState_S][StepClass_U] = StepState_Su;
+      transitions[StepState_Su][StepClass_S] = StepState_Sus;
+      transitions[StepState_Sus][StepClass_Two] = StepState_Quality;
+      transitions[StepState_Sus][StepClass_Four] = StepState_Quality;
+      StepState figured[2] = { StepState_Numeral, StepState_Quality };
+      for ( int i = 0; i < 2; i++ )
+      {
+        transitions[figured[i]][StepClass_Six] = StepState_Sixth;
+        transitions[figured[i]][StepClass_Slash] = StepState_Slash;
+      }
+      transitions[StepState_Sixth][StepClass_Four] = StepState_SixFour;
+      transitions[StepState_Sixth][StepClass_Slash] = StepState_Slash;
+      transitions[StepState_SixFour][StepClass_Slash] = StepState_Slash;
+    }
+  };
+
+  const StepTable g_stepTable;
+
+  // Root of a numeral: a note of the scale for plain degrees, or measured
+  // from the major scale on the tonic when it has an accidental
+  inline bool numeralRoot( const Scale& scale, const StepNumeral& numeral, Note& root )
+  {
+    if ( numeral.accidental ) {
+      root = scale.getRoot() + (Semitones)( g_majorDegreeOffsets[numeral.degree] + numeral.accidental );
+      return true;
     }
+    if ( numeral.degree >= scale.getDegreeCount() )
+      return false;
+    root = scale.getNotes()[numeral.degree];
+    return true;
   }
 
-  wstring implode( const ProgressionVector& v, wstring delim )
+  // Works out the chord of a parsed step in a scale
+  inline bool resolveStep( const Scale& scale, ChordProgressionStep& step, ParseResult& result )
   {
-    std::wostringstream str;
-    for ( ProgressionVector::const_iterator it = v.begin(); it != v.end(); ++it )
+    Note root;
+    result = Parse_UnknownNumeral;
+    if ( step.applied ) {
+      if ( !numeralRoot( scale, step.target, root ) )
+        return false;
+      root += (Semitones)( g_majorDegreeOffsets[step.numeral.degree] + step.numeral.accidental );
+    } else if ( !numeralRoot( scale, step.numeral, root ) )
+      return false;
+    ChordType type;
+    if ( step.quality )
+      type = g_stepQualityChords[step.quality];
+    else if ( step.applied || step.numeral.accidental ) {
+      if ( step.numeral.upper )
+        type = ChordType_Major;
+      else
+        type = step.numeral.degree == Degree_Subsemitone ? ChordType_Diminished : ChordType_Minor;
+    } else if ( scale.hasTriad( step.numeral.degree ) )
+      type = scale.getTriad( step.numeral.degree ).type;
+    else {
+      result = Parse_NoTriadOnDegree;
+      return false;
+    }
+    step.degree = step.numeral.degree;
+    step.chord = Triad( root, type );
+    return true;
+  }
+
+  // One step of a progression, at the given position of the whole string
+
+  inline bool parseStep( const StringView& token, size_t position, const Scale& scale, ChordProgressionStep& step, ParseError& error )
+  {
+    if ( token.empty() )
+      return error.fail( Parse_EmptyStep, position );
+    // Bare numerals, by far the most common, skip the state machine
+    Degree degree;
+    if ( parseNumeral( token, degree ) ) {
+      if ( !scale.hasTriad( degree ) )
+        return error.fail( degree < scale.getDegreeCount() ? Parse_NoTriadOnDegree : Parse_UnknownNumeral, position );
+      step = ChordProgressionStep( degree, scale.getTriad( degree ) );
+      step.numeral.upper = token[0] < 'a';
+      return true;
+    }
+    step = ChordProgressionStep( Degree_Tonic, Triad() );
+    StepState state = StepState_Start;
+    StepNumeral* numeral = &step.numeral;
+    size_t numeralStart = 0;
+    int key = 0, digit = 1;
+    for ( size_t i = 0; i <= token.length(); i++ )
     {
-      if ( it != v.begin() )
-        str << delim;
-      str << (*it).str;
+      char c = i < token.length() ? token[i] : '\0';
+      StepState next = c && (unsigned char)c < 128 ? g_stepTable.transitions[state][g_stepTable.classes[(unsigned char)c]] : StepState_Error;
+      // Numerals are looked up as a whole once their last letter is read
+      if ( ( state == StepState_Numeral || state == StepState_TargetNumeral ) && next != state ) {
+        if ( g_numeralDegrees[key] < 0 )
+          return error.fail( Parse_UnknownNumeral, position + numeralStart );
+        numeral->degree = (Degree)g_numeralDegrees[key];
+      }
+      if ( i == token.length() )
+        break;
+      switch ( next )
+      {
+        case StepState_Error:
+          return error.fail( state <= StepState_Accidental || state >= StepState_Slash
+            ? Parse_UnknownNumeral : Parse_UnknownStepQuality, position + i );
+        case StepState_Accidental:
+        case StepState_TargetAccidental:
+          numeral->accidental = c == 'b' ? Accidental_Flat : Accidental_Sharp;
+        break;
+        case StepState_Numeral:
+        case StepState_TargetNumeral:
+          if ( state != next ) {
+            numeralStart = i;
+            numeral->upper = c < 'a';
+            key = 0;
+            digit = 1;
+          }
+          if ( digit == 27 )
+            return error.fail( Parse_UnknownNumeral, position + numeralStart );
+          key += ( lowerAscii( c ) == 'i' ? 1 : 2 ) * digit;
+          digit *= 3;
+        break;
+        case StepState_Quality:
+          step.quality = c == '+' ? StepQuality_Augmented : lowerAscii( c ) == 'o' ? StepQuality_Diminished
+            : c == '4' ? StepQuality_SuspendedFourth : StepQuality_SuspendedSecond;
+        break;
+        case StepState_Sixth:
+          step.inversion = Inversion_First;
+        break;
+        case StepState_SixFour:
+          step.inversion = Inversion_Second;
+        break;
+        case StepState_Slash:
+          step.applied = true;
+          numeral = &step.target;
+        break;
+        default:
+        break;
+      }
+      state = next;
+    }
+    switch ( state )
+    {
+      case StepState_Numeral:
+      case StepState_Quality:
+      case StepState_Sixth:
+      case StepState_SixFour:
+      case StepState_TargetNumeral:
+      break;
+      case StepState_S:
+      case StepState_Su:
+      case StepState_Sus:
+        return error.fail( Parse_UnknownStepQuality, position + token.length() );
+      default:
+        return error.fail( Parse_UnknownNumeral, position + token.length() );
+    }
+    ParseResult result;
+    if ( !resolveStep( scale, step, result ) )
+      return error.fail( result, step.applied && result == Parse_UnknownNumeral
+        ? position + token.find( '/' ) + 1 : position );
+    return true;
+  }
+
+  // Writes a step back out. Plain steps take the numeral of their degree
+  // in the scale, the rest are written the way they were given.
+
+  inline void appendNumeral( const StepNumeral& numeral, string& str )
+  {
+    if ( numeral.accidental )
+      str.push_back( numeral.accidental < 0 ? 'b' : '#' );
+    str.append( numeral.upper ? g_numeralsUpper[numeral.degree] : g_numeralsLower[numeral.degree] );
+  }
+
+  inline void appendStep( const Scale& scale, const ChordProgressionStep& step, string& str )
+  {
+    if ( step.isPlain() ) {
+      str.append( scale.getDegree( step.degree ) );
+      return;
+    }
+    appendNumeral( step.numeral, str );
+    str.append( g_stepQualitiesStr[step.quality] );
+    str.append( g_inversionFiguresStr[step.inversion] );
+    if ( step.applied ) {
+      str.push_back( '/' );
+      appendNumeral( step.target, str );
     }
-    return str.str();
   }
 
   class ChordProgression {
   protected:
     ProgressionVector progression;
-    DiatonicScale scale;
+    Scale scale;
   public:
-    void print()
+    explicit ChordProgression( const Scale& _scale ): scale( _scale )
     {
-      wstring prog = implode( progression, L"-" );
-      wprintf_s( L"Chord progression %s in %s:\r\n", prog.c_str(), scale.getName().c_str() );
-      for ( ProgressionVector::iterator it = progression.begin(); it != progression.end(); ++it )
-      {
-        wprintf_s( L"- %s\r\n", (*it).chord.getName().c_str() );
-        wprintf_s( L"  %s\r\n", (*it).chord.getString().c_str() );
-      }
     }
-    ChordProgression( DiatonicScale _scale, wstring _progression ):
-    scale( _scale )
+    bool parse( const StringView& str, ParseError& error )
     {
-      StringVector chordtypes;
-      explode( _progression, L"-", chordtypes );
-      for ( StringVector::iterator it = chordtypes.begin(); it != chordtypes.end(); ++it )
+      CHROMATIC_STATS_SCOPE( Stats_ParseProgression );
+      progression.clear();
+      progression.reserve( std::count( str.begin(), str.end(), '-' ) + 1 );
+      Tokenizer tokenizer( str, '-' );
+      StringView token;
+      size_t position;
+      ChordProgressionStep step( Degree_Tonic, Triad() );
+      while ( tokenizer.next( token, position ) )
       {
-        if ( boost::iequals( (*it), L"i" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Tonic ), scale.getTriad( Degree_Tonic ) ) );
-        } else if ( boost::iequals( (*it), L"ii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Supertonic ), scale.getTriad( Degree_Supertonic ) ) );
-        } else if ( boost::iequals( (*it), L"iii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Mediant ), scale.getTriad( Degree_Mediant ) ) );
-        } else if ( boost::iequals( (*it), L"iv" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Subdominant ), scale.getTriad( Degree_Subdominant ) ) );
-        } else if ( boost::iequals( (*it), L"v" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Dominant ), scale.getTriad( Degree_Dominant ) ) );
-        } else if ( boost::iequals( (*it), L"vi" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Submediant ), scale.getTriad( Degree_Submediant ) ) );
-        } else if ( boost::iequals( (*it), L"vii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Subsemitone ), scale.getTriad( Degree_Subsemitone ) ) );
-        }
+        if ( !parseStep( token, position, scale, step, error ) )
+          return false;
+        progression.push_back( step );
       }
+      return true;
+    }
+    // Moves the progression into the same mode on another root; the
+    // numerals stay, the chords follow the scale
+    void transpose( Semitones interval )
+    {
+      scale = Scale( scale.getRoot() + interval, scale.getMode() );
+      ParseResult result;
+      for ( ProgressionVector::iterator it = progression.begin(); it != progression.end(); ++it )
+        resolveStep( scale, *it, result );
+    }
+    const Scale& getScale() const
+    {
+      return scale;
+    }
+    const ProgressionVector& getSteps() const
+    {
+      return progression;
     }
   };
 
@@ -22,16 +22,16 @@
 #include <iostream>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
-#include <boost/tokenizer.hpp>
 
 #include "chromaticTypes.h"
+#include "chromaticStats.h"
 
 namespace chromatic {
 
-  using std::wstring;
+  using std::string;
   using std::vector;
 
-  enum ChordType: int {
+  enum ChordType: unsigned char {
     ChordType_Major,
     ChordType_Minor,
     ChordType_Augmented,
@@ -40,86 +40,172 @@ namespace chromatic {
     ChordType_SuspendedSecond
   };
 
-  const wchar_t* g_chordsFullStr[6] = {
-    L"Major", L"Minor", L"Augmented", L"Diminished", L"Suspended Fourth", L"Suspended Second"
+  const char* g_chordsFullStr[6] = {
+    "Major", "Minor", "Augmented", "Diminished", "Suspended Fourth", "Suspended Second"
   };
 
-  const wchar_t* g_chordsSuffixStr[6] = {
-    L"", L"m", L"a", L"o", L"sus4", L"sus2"
+  const char* g_chordsSuffixStr[6] = {
+    "", "m", "a", "o", "sus4", "sus2"
   };
 
-  struct Chord {
-  protected:
-    wstring _name;
-    wstring _str;
-  public:
-    virtual const wstring& getName() = 0;
-    virtual const wstring& getString() = 0;
+  // Pitch content and display strings of every triad, indexed [root][type]
+
+  const Note g_triadNotes[12][6][3] = {
+    {
+      { Note_C, Note_E, Note_G },
+      { Note_C, Note_Ds, Note_G },
+      { Note_C, Note_E, Note_Gs },
+      { Note_C, Note_Ds, Note_Fs },
+      { Note_C, Note_F, Note_G },
+      { Note_C, Note_D, Note_G }
+    },
+    {
+      { Note_Cs, Note_F, Note_Gs },
+      { Note_Cs, Note_E, Note_Gs },
+      { Note_Cs, Note_F, Note_A },
+      { Note_Cs, Note_E, Note_G },
+      { Note_Cs, Note_Fs, Note_Gs },
+      { Note_Cs, Note_Ds, Note_Gs }
+    },
+    {
+      { Note_D, Note_Fs, Note_A },
+      { Note_D, Note_F, Note_A },
+      { Note_D, Note_Fs, Note_As },
+      { Note_D, Note_F, Note_Gs },
+      { Note_D, Note_G, Note_A },
+      { Note_D, Note_E, Note_A }
+    },
+    {
+      { Note_Ds, Note_G, Note_As },
+      { Note_Ds, Note_Fs, Note_As },
+      { Note_Ds, Note_G, Note_B },
+      { Note_Ds, Note_Fs, Note_A },
+      { Note_Ds, Note_Gs, Note_As },
+      { Note_Ds, Note_F, Note_As }
+    },
+    {
+      { Note_E, Note_Gs, Note_B },
+      { Note_E, Note_G, Note_B },
+      { Note_E, Note_Gs, Note_C },
+      { Note_E, Note_G, Note_As },
+      { Note_E, Note_A, Note_B },
+      { Note_E, Note_Fs, Note_B }
+    },
+    {
+      { Note_F, Note_A, Note_C },
+      { Note_F, Note_Gs, Note_C },
+      { Note_F, Note_A, Note_Cs },
+      { Note_F, Note_Gs, Note_B },
+      { Note_F, Note_As, Note_C },
+      { Note_F, Note_G, Note_C }
+    },
+    {
+      { Note_Fs, Note_As, Note_Cs },
+      { Note_Fs, Note_A, Note_Cs },
+      { Note_Fs, Note_As, Note_D },
+      { Note_Fs, Note_A, Note_C },
+      { Note_Fs, Note_B, Note_Cs },
+      { Note_Fs, Note_Gs, Note_Cs }
+    },
+    {
+      { Note_G, Note_B, Note_D },
+      { Note_G, Note_As, Note_D },
+      { Note_G, Note_B, Note_Ds },
+      { Note_G, Note_As, Note_Cs },
+      { Note_G, Note_C, Note_D },
+      { Note_G, Note_A, Note_D }
+    },
+    {
+      { Note_Gs, Note_C, Note_Ds },
+      { Note_Gs, Note_B, Note_Ds },
+      { Note_Gs, Note_C, Note_E },
+      { Note_Gs, Note_B, Note_D },
+      { Note_Gs, Note_Cs, Note_Ds },
+      { Note_Gs, Note_As, Note_Ds }
+    },
+    {
+      { Note_A, Note_Cs, Note_E },
+      { Note_A, Note_C, Note_E },
+      { Note_A, Note_Cs, Note_F },
+      { Note_A, Note_C, Note_Ds },
+      { Note_A, Note_D, Note_E },
+      { Note_A, Note_B, Note_E }
+    },
+    {
+      { Note_As, Note_D, Note_F },
+      { Note_As, Note_Cs, Note_F },
+      { Note_As, Note_D, Note_Fs },
+      { Note_As, Note_Cs, Note_E },
+      { Note_As, Note_Ds, Note_F },
+      { Note_As, Note_C, Note_F }
+    },
+    {
+      { Note_B, Note_Ds, Note_Fs },
+      { Note_B, Note_D, Note_Fs },
+      { Note_B, Note_Ds, Note_G },
+      { Note_B, Note_D, Note_F },
+      { Note_B, Note_E, Note_Fs },
+      { Note_B, Note_Cs, Note_Fs }
+    }
+  };
+
+  const char* g_triadNames[12][6] = {
+    { "C Major", "C Minor", "C Augmented", "C Diminished", "C Suspended Fourth", "C Suspended Second" },
+    { "C# Major", "C# Minor", "C# Augmented", "C# Diminished", "C# Suspended Fourth", "C# Suspended Second" },
+    { "D Major", "D Minor", "D Augmented", "D Diminished", "D Suspended Fourth", "D Suspended Second" },
+    { "D# Major", "D# Minor", "D# Augmented", "D# Diminished", "D# Suspended Fourth", "D# Suspended Second" },
+    { "E Major", "E Minor", "E Augmented", "E Diminished", "E Suspended Fourth", "E Suspended Second" },
+    { "F Major", "F Minor", "F Augmented", "F Diminished", "F Suspended Fourth", "F Suspended Second" },
+    { "F# Major", "F# Minor", "F# Augmented", "F# Diminished", "F# Suspended Fourth", "F# Suspended Second" },
+    { "G Major", "G Minor", "G Augmented", "G Diminished", "G Suspended Fourth", "G Suspended Second" },
+    { "G# Major", "G# Minor", "G# Augmented", "G# Diminished", "G# Suspended Fourth", "G# Suspended Second" },
+    { "A Major", "A Minor", "A Augmented", "A Diminished", "A Suspended Fourth", "A Suspended Second" },
+    { "A# Major", "A# Minor", "A# Augmented", "A# Diminished", "A# Suspended Fourth", "A# Suspended Second" },
+    { "B Major", "B Minor", "B Augmented", "B Diminished", "B Suspended Fourth", "B Suspended Second" }
+  };
+
+  const char* g_triadStrings[12][6] = {
+    { "C-E-G", "C-D#-G", "C-E-G#", "C-D#-F#", "C-F-G", "C-D-G" },
+    { "C#-F-G#", "C#-E-G#", "C#-F-A", "C#-E-G", "C#-F#-G#", "C#-D#-G#" },
+    { "D-F#-A", "D-F-A", "D-F#-A#", "D-F-G#", "D-G-A", "D-E-A" },
+    { "D#-G-A#", "D#-F#-A#", "D#-G-B", "D#-F#-A", "D#-G#-A#", "D#-F-A#" },
+    { "E-G#-B", "E-G-B", "E-G#-C", "E-G-A#", "E-A-B", "E-F#-B" },
+    { "F-A-C", "F-G#-C", "F-A-C#", "F-G#-B", "F-A#-C", "F-G-C" },
+    { "F#-A#-C#", "F#-A-C#", "F#-A#-D", "F#-A-C", "F#-B-C#", "F#-G#-C#" },
+    { "G-B-D", "G-A#-D", "G-B-D#", "G-A#-C#", "G-C-D", "G-A-D" },
+    { "G#-C-D#", "G#-B-D#", "G#-C-E", "G#-B-D", "G#-C#-D#", "G#-A#-D#" },
+    { "A-C#-E", "A-C-E", "A-C#-F", "A-C-D#", "A-D-E", "A-B-E" },
+    { "A#-D-F", "A#-C#-F", "A#-D-F#", "A#-C#-E", "A#-D#-F", "A#-C-F" },
+    { "B-D#-F#", "B-D-F#", "B-D#-G", "B-D-F", "B-E-F#", "B-C#-F#" }
   };
 
   struct Triad;
   typedef vector<Triad> TriadVector;
 
-  struct Triad: public Chord {
+  // A triad is four bytes and trivially copyable; its names live in the
+  // static tables above.
+
+  struct Triad {
   public:
     Note first;
     Note second;
     Note third;
     ChordType type;
-    Triad( const Note& root, ChordType _type ): first( root ), type( _type )
-    {
-      switch ( type ) {
-        case ChordType_Major:
-          second = root + Interval_ThirdMajor;
-          third = root + Interval_Fifth;
-        break;
-        case ChordType_Minor:
-          second = root + Interval_ThirdMinor;
-          third = root + Interval_Fifth;
-        break;
-        case ChordType_Augmented:
-          second = root + Interval_ThirdMajor;
-          third = root + Interval_Fifth + 1;
-        break;
-        case ChordType_Diminished:
-          second = root + Interval_ThirdMinor;
-          third = root + Interval_Fifth - 1;
-        break;
-        case ChordType_SuspendedFourth:
-          second = root + Interval_Fourth;
-          third = root + Interval_Fifth;
-        break;
-        case ChordType_SuspendedSecond:
-          second = root + Interval_SecondMajor;
-          third = root + Interval_Fifth;
-        break;
-      }
+    Triad(): first( Note_C ), second( Note_E ), third( Note_G ), type( ChordType_Major )
+    {
     }
-    void print()
+    Triad( const Note& root, ChordType _type ): first( root ),
+    second( g_triadNotes[root][_type][1] ), third( g_triadNotes[root][_type][2] ), type( _type )
     {
-      wprintf_s( L"Chord %s:\r\n", getName().c_str() );
-      wprintf_s( L"- %s\r\n", getString().c_str() );
+      CHROMATIC_STATS_COUNT( Stats_Triad );
     }
-    const wstring& getName()
-    {
-      if ( _name.empty() )
-      {
-        _name = g_notesSharpStr[first];
-        _name.append( L" " );
-        _name.append( g_chordsFullStr[type] );
-      }
-      return _name;
+    const char* getName() const
+    {
+      return g_triadNames[first][type];
     }
-    const wstring& getString()
-    {
-      if ( _str.empty() )
-      {
-        _str.resize( 16 );
-        int chars = swprintf_s( &_str[0], 16, L"%s-%s-%s", g_notesSharpStr[first], g_notesSharpStr[second], g_notesSharpStr[third] );
-        if ( chars < 16 )
-          _str.reserve( chars );
-      }
-      return _str;
+    const char* getString() const
+    {
+      return g_triadStrings[first][type];
     }
     static Triad makeMajor( Note root ) {
       return Triad( root, ChordType_Major );
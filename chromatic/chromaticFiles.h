@@ -0,0 +1,353 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#endif
+
+namespace chromatic {
+
+  using std::string;
+  using std::vector;
+
+  // Paths are UTF-8 throughout; Windows gets them as UTF-16 at the API
+  // boundary, everywhere else they are passed through as they are.
+
+#ifdef _WIN32
+  inline std::wstring widenUtf8( const string& str )
+  {
+    int length = MultiByteToWideChar( CP_UTF8, 0, str.data(), (int)str.length(), NULL, 0 );
+    std::wstring result( length, L'\0' );
+    if ( length )
+      MultiByteToWideChar( CP_UTF8, 0, str.data(), (int)str.length(), &result[0], length );
+    return result;
+  }
+
+  inline string narrowUtf8( const wchar_t* str )
+  {
+    int length = WideCharToMultiByte( CP_UTF8, 0, str, -1, NULL, 0, NULL, NULL );
+    string result( length > 0 ? length - 1 : 0, '\0' );
+    if ( length > 1 )
+      WideCharToMultiByte( CP_UTF8, 0, str, -1, &result[0], length, NULL, NULL );
+    return result;
+  }
+#endif
+
+  inline FILE* openFile( const string& path, const char* mode )
+  {
+#ifdef _WIN32
+    return _wfopen( widenUtf8( path ).c_str(), widenUtf8( mode ).c_str() );
+#else
+    return fopen( path.c_str(), mode );
+#endif
+  }
+
+  // Moves a file over another one, replacing it in a single step
+  inline bool replaceFile( const string& from, const string& to )
+  {
+#ifdef _WIN32
+    return MoveFileExW( widenUtf8( from ).c_str(), widenUtf8( to ).c_str(), MOVEFILE_REPLACE_EXISTING ) != FALSE;
+#else
+    return rename( from.c_str(), to.c_str() ) == 0;
+#endif
+  }
+
+  inline bool removeFile( const string& path )
+  {
+#ifdef _WIN32
+    return DeleteFileW( widenUtf8( path ).c_str() ) != FALSE;
+#else
+    return unlink( path.c_str() ) == 0;
+#endif
+  }
+
+  // Creates a file next to the given path, under a name no other save in
+  // this or another process is using, and opens it for writing
+  inline FILE* createTemporaryFile( const string& path, string& temporary )
+  {
+    static std::atomic<unsigned int> counter( 0 );
+#ifdef _WIN32
+    string process = std::to_string( (unsigned long long)GetCurrentProcessId() );
+#else
+    string process = std::to_string( (unsigned long long)getpid() );
+#endif
+    for ( int attempt = 0; attempt < 100; attempt++ )
+    {
+      temporary = path + "." + process + "." + std::to_string( (unsigned long long)counter++ ) + ".tmp";
+#ifdef _WIN32
+      HANDLE handle = CreateFileW( widenUtf8( temporary ).c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL );
+      if ( handle == INVALID_HANDLE_VALUE ) {
+        if ( GetLastError() == ERROR_FILE_EXISTS )
+          continue;
+        return NULL;
+      }
+      int fd = _open_osfhandle( (intptr_t)handle, _O_BINARY );
+      if ( fd < 0 ) {
+        CloseHandle( handle );
+        return NULL;
+      }
+      FILE* file = _fdopen( fd, "wb" );
+      if ( !file )
+        _close( fd );
+#else
+      int fd = ::open( temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666 );
+      if ( fd < 0 ) {
+        if ( errno == EEXIST )
+          continue;
+        return NULL;
+      }
+      FILE* file = fdopen( fd, "wb" );
+      if ( !file )
+        ::close( fd );
+#endif
+      if ( !file )
+        removeFile( temporary );
+      return file;
+    }
+    return NULL;
+  }
+
+  // Saves a file by writing it to a temporary file and moving that over
+  // the path, so that a failed save leaves the previous file in place and
+  // concurrent saves never write into each other's output. write gets the
+  // open file and returns whether everything was written.
+  template <class Write>
+  bool saveFile( const string& path, Write write )
+  {
+    string temporary;
+    FILE* file = createTemporaryFile( path, temporary );
+    if ( !file )
+      return false;
+    bool written = write( file );
+    written = fclose( file ) == 0 && written;
+    if ( written && replaceFile( temporary, path ) )
+      return true;
+    removeFile( temporary );
+    return false;
+  }
+
+  // Read-only view of a whole file, mapped into memory so that large
+  // files are paged in as they are read rather than copied
+
+  class MappedFile {
+  protected:
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+  public:
+    MappedFile(): data( NULL ), size( 0 )
+#ifdef _WIN32
+    , file( INVALID_HANDLE_VALUE ), mapping( NULL )
+#endif
+    {
+    }
+    ~MappedFile()
+    {
+      close();
+    }
+    bool open( const string& path )
+    {
+      close();
+#ifdef _WIN32
+      file = CreateFileW( widenUtf8( path ).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+      if ( file == INVALID_HANDLE_VALUE )
+        return false;
+      LARGE_INTEGER fileSize;
+      if ( !GetFileSizeEx( file, &fileSize ) || (unsigned long long)fileSize.QuadPart > (size_t)-1 )
+        return false;
+      size = (size_t)fileSize.QuadPart;
+      if ( !size )
+        return true;
+      mapping = CreateFileMappingW( file, NULL, PAGE_READONLY, 0, 0, NULL );
+      if ( !mapping )
+        return false;
+      data = (const unsigned char*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+      return data != NULL;
+#else
+      int fd = ::open( path.c_str(), O_RDONLY );
+      if ( fd < 0 )
+        return false;
+      struct stat info;
+      if ( fstat( fd, &info ) != 0 || !S_ISREG( info.st_mode ) ) {
+        ::close( fd );
+        return false;
+      }
+      size = (size_t)info.st_size;
+      if ( size ) {
+        void* view = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        data = view == MAP_FAILED ? NULL : (const unsigned char*)view;
+      }
+      ::close( fd );
+      return data != NULL || !size;
+#endif
+    }
+    void close()
+    {
+#ifdef _WIN32
+      if ( data )
+        UnmapViewOfFile( data );
+      if ( mapping )
+        CloseHandle( mapping );
+      if ( file != INVALID_HANDLE_VALUE )
+        CloseHandle( file );
+      mapping = NULL;
+      file = INVALID_HANDLE_VALUE;
+#else
+      if ( data )
+        munmap( (void*)data, size );
+#endif
+      data = NULL;
+      size = 0;
+    }
+    const unsigned char* getData() const
+    {
+      return data;
+    }
+    size_t getSize() const
+    {
+      return size;
+    }
+  };
+
+  // Walks a directory tree one entry at a time, keeping only the chain of
+  // open directories, so trees of any size are listed in constant memory
+
+  class DirectoryWalker {
+  protected:
+    struct Level {
+      string path;
+#ifdef _WIN32
+      HANDLE find;
+      WIN32_FIND_DATAW entry;
+      bool pending;
+#else
+      DIR* dir;
+#endif
+    };
+    vector<Level> levels;
+    bool push( const string& path )
+    {
+      Level level;
+      level.path = path;
+#ifdef _WIN32
+      level.find = FindFirstFileW( widenUtf8( path + "\\*" ).c_str(), &level.entry );
+      if ( level.find == INVALID_HANDLE_VALUE )
+        return false;
+      level.pending = true;
+#else
+      level.dir = opendir( path.c_str() );
+      if ( !level.dir )
+        return false;
+#endif
+      levels.push_back( level );
+      return true;
+    }
+    void pop()
+    {
+#ifdef _WIN32
+      FindClose( levels.back().find );
+#else
+      closedir( levels.back().dir );
+#endif
+      levels.pop_back();
+    }
+  public:
+    ~DirectoryWalker()
+    {
+      while ( !levels.empty() )
+        pop();
+    }
+    bool open( const string& path )
+    {
+      while ( !levels.empty() )
+        pop();
+      return push( path );
+    }
+    // Next regular file below the directory, in directory order
+    bool next( string& path )
+    {
+      while ( !levels.empty() )
+      {
+        Level& level = levels.back();
+        string name;
+        bool directory;
+#ifdef _WIN32
+        if ( !level.pending && !FindNextFileW( level.find, &level.entry ) ) {
+          pop();
+          continue;
+        }
+        level.pending = false;
+        name = narrowUtf8( level.entry.cFileName );
+        directory = ( level.entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0;
+        if ( level.entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT )
+          continue;
+        string full = level.path + "\\" + name;
+#else
+        struct dirent* entry = readdir( level.dir );
+        if ( !entry ) {
+          pop();
+          continue;
+        }
+        name = entry->d_name;
+        string full = level.path + "/" + name;
+        struct stat info;
+        if ( lstat( full.c_str(), &info ) != 0 || S_ISLNK( info.st_mode ) )
+          continue;
+        directory = S_ISDIR( info.st_mode );
+        if ( !directory && !S_ISREG( info.st_mode ) )
+          continue;
+#endif
+        if ( name == "." || name == ".." )
+          continue;
+        if ( directory ) {
+          push( full );
+          continue;
+        }
+        path = full;
+        return true;
+      }
+      return false;
+    }
+  };
+
+}
\ No newline at end of file
@@ -0,0 +1,199 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "chromaticTypes.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticParser.h"
+
+namespace chromatic {
+
+  using std::vector;
+
+  typedef vector<Degree> DegreeVector;
+
+  const int g_generateMaxLength = 16;
+
+  // Constraints on generated progressions. Degree sets are masks with one
+  // bit per degree, the tonic in the lowest bit. A maximum repeat of zero
+  // allows any number of consecutive steps on the same degree.
+
+  struct GenerateConstraints {
+    int length;
+    unsigned char start;
+    unsigned char end;
+    unsigned char banned[7];
+    DegreeVector cadence;
+    int maxRepeat;
+    GenerateConstraints(): length( 4 ), start( 0x7F ), end( 0x7F ), maxRepeat( 0 )
+    {
+      memset( banned, 0, sizeof( banned ) );
+    }
+  };
+
+  bool parseDegrees( const StringView& str, DegreeVector& degrees, ParseError& error )
+  {
+    degrees.clear();
+    Tokenizer tokenizer( str, '-' );
+    StringView token;
+    size_t position;
+    while ( tokenizer.next( token, position ) )
+    {
+      Degree degree;
+      if ( token.empty() )
+        return error.fail( Parse_EmptyStep, position );
+      if ( !parseNumeral( token, degree ) )
+        return error.fail( Parse_UnknownNumeral, position );
+      degrees.push_back( degree );
+    }
+    return true;
+  }
+
+  // Enumerates every progression over the seven degree triads of a scale
+  // that satisfies a set of constraints. The number of valid completions of
+  // every partial progression is tabulated up front, working backwards from
+  // the last step, so the search never enters a branch without results and
+  // the total is known before anything is enumerated.
+
+  class ProgressionGenerator {
+  protected:
+    Scale scale;
+    int length;
+    int maxRepeat;
+    unsigned char allowed[g_generateMaxLength];
+    unsigned char banned[7];
+    // Completions of a progression whose step at a position is on a degree
+    // that has been repeated for a run of steps
+    unsigned long long completions[g_generateMaxLength][7][g_generateMaxLength + 1];
+    unsigned long long following( int position, int degree, int run, int next ) const
+    {
+      if ( banned[degree] & ( 1 << next ) )
+        return 0;
+      if ( next == degree )
+        return run < maxRepeat ? completions[position + 1][next][run + 1] : 0;
+      return completions[position + 1][next][1];
+    }
+    template <class Sink>
+    void walk( Degree* degrees, int position, int run, Sink& sink ) const
+    {
+      if ( position == length - 1 ) {
+        sink( degrees, length );
+        return;
+      }
+      for ( int next = Degree_Tonic; next <= Degree_Subsemitone; next++ )
+      {
+        if ( !following( position, degrees[position], run, next ) )
+          continue;
+        degrees[position + 1] = (Degree)next;
+        walk( degrees, position + 1, next == degrees[position] ? run + 1 : 1, sink );
+      }
+    }
+  public:
+    ProgressionGenerator( const Scale& _scale, const GenerateConstraints& constraints ):
+    scale( _scale ), length( constraints.length )
+    {
+      maxRepeat = ( constraints.maxRepeat > 0 && constraints.maxRepeat < length ) ? constraints.maxRepeat : length;
+      memcpy( banned, constraints.banned, sizeof( banned ) );
+      memset( allowed, scale.getTriadDegrees(), sizeof( allowed ) );
+      memset( completions, 0, sizeof( completions ) );
+      allowed[0] &= constraints.start;
+      allowed[length - 1] &= constraints.end;
+      int cadence = (int)constraints.cadence.size();
+      if ( cadence > length )
+        return;
+      for ( int i = 0; i < cadence; i++ )
+        allowed[length - cadence + i] &= 1 << constraints.cadence[i];
+      for ( int position = length - 1; position >= 0; position-- )
+        for ( int degree = Degree_Tonic; degree <= Degree_Subsemitone; degree++ )
+        {
+          if ( !( allowed[position] & ( 1 << degree ) ) )
+            continue;
+          for ( int run = 1; run <= maxRepeat; run++ )
+          {
+            if ( position == length - 1 ) {
+              completions[position][degree][run] = 1;
+              continue;
+            }
+            unsigned long long total = 0;
+            for ( int next = Degree_Tonic; next <= Degree_Subsemitone; next++ )
+              total += following( position, degree, run, next );
+            completions[position][degree][run] = total;
+          }
+        }
+    }
+    const Scale& getScale() const
+    {
+      return scale;
+    }
+    int getLength() const
+    {
+      return length;
+    }
+    // Number of valid progressions starting with the given steps
+    unsigned long long count( const Degree* prefix, int prefixLength ) const
+    {
+      if ( !prefixLength ) {
+        unsigned long long total = 0;
+        for ( int degree = Degree_Tonic; degree <= Degree_Subsemitone; degree++ )
+          total += completions[0][degree][1];
+        return total;
+      }
+      if ( !completions[0][prefix[0]][1] )
+        return 0;
+      unsigned long long total = completions[0][prefix[0]][1];
+      int run = 1;
+      for ( int i = 1; i < prefixLength && total; i++ )
+      {
+        total = following( i - 1, prefix[i - 1], run, prefix[i] );
+        run = prefix[i] == prefix[i - 1] ? run + 1 : 1;
+      }
+      return total;
+    }
+    // Calls sink( degrees, length ) for every valid progression starting
+    // with the given steps, in order of ascending degrees
+    template <class Sink>
+    void enumerate( const Degree* prefix, int prefixLength, Sink& sink ) const
+    {
+      Degree degrees[g_generateMaxLength];
+      if ( !count( prefix, prefixLength ) )
+        return;
+      if ( !prefixLength ) {
+        for ( int degree = Degree_Tonic; degree <= Degree_Subsemitone; degree++ )
+        {
+          if ( !completions[0][degree][1] )
+            continue;
+          degrees[0] = (Degree)degree;
+          walk( degrees, 0, 1, sink );
+        }
+        return;
+      }
+      int run = 0;
+      for ( int i = 0; i < prefixLength; i++ )
+      {
+        degrees[i] = prefix[i];
+        run = ( i && prefix[i] == prefix[i - 1] ) ? run + 1 : 1;
+      }
+      walk( degrees, prefixLength - 1, run, sink );
+    }
+  };
+
+}
\ No newline at end of file
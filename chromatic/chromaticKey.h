@@ -0,0 +1,266 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "chromaticTypes.h"
+#include "chromaticScales.h"
+#include "chromaticScaleIndex.h"
+#include "chromaticTranspose.h"
+
+namespace chromatic {
+
+  using std::vector;
+
+  // Krumhansl-Kessler key profiles: how well each pitch class above the
+  // tonic fits a major or minor key
+
+  const float g_keyProfileMajor[12] = {
+    6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f
+  };
+
+  const float g_keyProfileMinor[12] = {
+    6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f
+  };
+
+  // Fixed point scale of the integer profile matrix
+
+  const int g_keyProfileOne = 1 << 12;
+
+  // The profiles of all 24 keys, centered and scaled to unit length, so
+  // that the correlation of a histogram with a key is its dot product with
+  // the key's profile divided by the length of the centered histogram.
+  // Stored by pitch class, each row holding the weight of that pitch class
+  // in every key at mode * 12 + root, so a histogram is scored against all
+  // keys at once by adding up twelve rows.
+
+  class KeyProfileTable {
+  public:
+    float weights[12][24];
+    int fixed[12][24];
+    KeyProfileTable()
+    {
+      const float* profiles[2] = { g_keyProfileMinor, g_keyProfileMajor };
+      for ( int mode = ScaleMode_Minor; mode <= ScaleMode_Major; mode++ )
+      {
+        float centered[12];
+        float mean = 0.0f, length = 0.0f;
+        for ( int i = 0; i < 12; i++ )
+          mean += profiles[mode][i] / 12.0f;
+        for ( int i = 0; i < 12; i++ )
+        {
+          centered[i] = profiles[mode][i] - mean;
+          length += centered[i] * centered[i];
+        }
+        length = sqrtf( length );
+        for ( int root = Note_C; root <= Note_B; root++ )
+          for ( int note = Note_C; note <= Note_B; note++ )
+          {
+            float weight = centered[( note - root + 12 ) % 12] / length;
+            weights[note][mode * 12 + root] = weight;
+            fixed[note][mode * 12 + root] = (int)floorf( weight * g_keyProfileOne + 0.5f );
+          }
+      }
+    }
+  };
+
+  const KeyProfileTable g_keyProfiles;
+
+  struct KeyEstimate {
+    Scale scale;
+    float correlation;
+  };
+
+  typedef vector<KeyEstimate> KeyEstimateVector;
+
+  namespace detail {
+
+    // scores[key] = sum over pitch classes of histogram[note] * weights[note][key]
+
+    inline void scoreKeys( const float histogram[12], float scores[24] )
+    {
+#ifdef CHROMATIC_SSE2
+      __m128 sums[6];
+      for ( int i = 0; i < 6; i++ )
+        sums[i] = _mm_setzero_ps();
+      for ( int note = 0; note < 12; note++ )
+      {
+        __m128 count = _mm_set1_ps( histogram[note] );
+        for ( int i = 0; i < 6; i++ )
+          sums[i] = _mm_add_ps( sums[i], _mm_mul_ps( count, _mm_loadu_ps( &g_keyProfiles.weights[note][i * 4] ) ) );
+      }
+      for ( int i = 0; i < 6; i++ )
+        _mm_storeu_ps( scores + i * 4, sums[i] );
+#else
+      for ( int key = 0; key < 24; key++ )
+        scores[key] = 0.0f;
+      for ( int note = 0; note < 12; note++ )
+        for ( int key = 0; key < 24; key++ )
+          scores[key] += histogram[note] * g_keyProfiles.weights[note][key];
+#endif
+    }
+
+    inline void addKeyRow( int scores[24], const int row[24] )
+    {
+#ifdef CHROMATIC_SSE2
+      for ( int i = 0; i < 24; i += 4 )
+        _mm_storeu_si128( (__m128i*)( scores + i ), _mm_add_epi32(
+          _mm_loadu_si128( (const __m128i*)( scores + i ) ), _mm_loadu_si128( (const __m128i*)( row + i ) ) ) );
+#else
+      for ( int key = 0; key < 24; key++ )
+        scores[key] += row[key];
+#endif
+    }
+
+    inline void subtractKeyRow( int scores[24], const int row[24] )
+    {
+#ifdef CHROMATIC_SSE2
+      for ( int i = 0; i < 24; i += 4 )
+        _mm_storeu_si128( (__m128i*)( scores + i ), _mm_sub_epi32(
+          _mm_loadu_si128( (const __m128i*)( scores + i ) ), _mm_loadu_si128( (const __m128i*)( row + i ) ) ) );
+#else
+      for ( int key = 0; key < 24; key++ )
+        scores[key] -= row[key];
+#endif
+    }
+
+    // Length of a histogram once its mean is taken out
+    inline double centeredLength( double sum, double sumOfSquares )
+    {
+      double length = sumOfSquares - sum * sum / 12.0;
+      return length > 0.0 ? sqrt( length ) : 0.0;
+    }
+
+    inline Scale keyScale( int key )
+    {
+      return Scale( (Note)( key % 12 ), (ScaleMode)( key / 12 ) );
+    }
+
+  }
+
+  // Ranks all 24 keys by correlation with a histogram of pitch class
+  // weights, best first. Ties go to major keys and lower roots.
+
+  void estimateKeys( const float histogram[12], KeyEstimateVector& estimates )
+  {
+    float scores[24];
+    detail::scoreKeys( histogram, scores );
+    double sum = 0.0, sumOfSquares = 0.0;
+    for ( int note = 0; note < 12; note++ )
+    {
+      sum += histogram[note];
+      sumOfSquares += (double)histogram[note] * histogram[note];
+    }
+    double length = detail::centeredLength( sum, sumOfSquares );
+    estimates.resize( 24 );
+    for ( int key = 0; key < 24; key++ )
+    {
+      estimates[key].scale = detail::keyScale( key );
+      estimates[key].correlation = length > 0.0 ? (float)( scores[key] / length ) : 0.0f;
+    }
+    std::sort( estimates.begin(), estimates.end(), []( const KeyEstimate& a, const KeyEstimate& b ) {
+      if ( a.correlation != b.correlation )
+        return a.correlation > b.correlation;
+      if ( a.scale.getMode() != b.scale.getMode() )
+        return a.scale.getMode() > b.scale.getMode();
+      return a.scale.getRoot() < b.scale.getRoot();
+    } );
+  }
+
+  // Follows the key of the most recent notes of a stream. The scores of
+  // all keys are kept up to date in fixed point as notes enter and leave
+  // the window, one row of the profile matrix each, so every note costs a
+  // few vector additions however long the window is.
+
+  class KeyTracker {
+  protected:
+    vector<Note> window;
+    size_t capacity;
+    size_t next;
+    size_t count;
+    int histogram[12];
+    int scores[24];
+    long long sumOfSquares;
+    void remove( Note note )
+    {
+      detail::subtractKeyRow( scores, g_keyProfiles.fixed[note] );
+      sumOfSquares -= 2 * histogram[note] - 1;
+      histogram[note]--;
+    }
+  public:
+    // Windows longer than this could overflow the fixed point scores
+    static const size_t maxWindow = 1 << 18;
+    explicit KeyTracker( size_t _capacity ): capacity( _capacity ? _capacity : 1 )
+    {
+      if ( capacity > maxWindow )
+        capacity = maxWindow;
+      window.resize( capacity );
+      reset();
+    }
+    void reset()
+    {
+      next = count = 0;
+      sumOfSquares = 0;
+      memset( histogram, 0, sizeof( histogram ) );
+      memset( scores, 0, sizeof( scores ) );
+    }
+    void push( Note note )
+    {
+      if ( count == capacity )
+        remove( window[next] );
+      else
+        count++;
+      window[next] = note;
+      next = next + 1 == capacity ? 0 : next + 1;
+      detail::addKeyRow( scores, g_keyProfiles.fixed[note] );
+      sumOfSquares += 2 * histogram[note] + 1;
+      histogram[note]++;
+    }
+    size_t size() const
+    {
+      return count;
+    }
+    // Best key of the notes in the window at mode * 12 + root, ties going
+    // to major keys and lower roots
+    int getBest() const
+    {
+      int best = ScaleMode_Major * 12;
+      for ( int key = ScaleMode_Major * 12 + 1; key < ScaleMode_Major * 12 + 12; key++ )
+        if ( scores[key] > scores[best] )
+          best = key;
+      for ( int key = ScaleMode_Minor * 12; key < ScaleMode_Minor * 12 + 12; key++ )
+        if ( scores[key] > scores[best] )
+          best = key;
+      return best;
+    }
+    KeyEstimate getKey() const
+    {
+      int best = getBest();
+      KeyEstimate estimate;
+      estimate.scale = detail::keyScale( best );
+      double length = detail::centeredLength( (double)count, (double)sumOfSquares );
+      estimate.correlation = length > 0.0 ? (float)( scores[best] / ( length * g_keyProfileOne ) ) : 0.0f;
+      return estimate;
+    }
+  };
+
+}
\ No newline at end of file
@@ -0,0 +1,492 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticFiles.h"
+#include "chromaticThreadPool.h"
+#include "chromaticProgressionFile.h"
+
+namespace chromatic {
+
+  using std::string;
+  using std::vector;
+
+  // Markov models of progressions. A state is the degree of a step and the
+  // type of its chord, and one more state marks the boundary before the
+  // first step and after the last. A model of order k counts how often
+  // each state follows every run of k states, and keeps the counts of the
+  // lower orders too, to fall back on for runs that were never seen.
+
+  const unsigned int g_markovChordTypes = ChordType_SuspendedSecond + 1;
+  const unsigned int g_markovStates = 7 * g_markovChordTypes + 1;
+  const unsigned char g_markovBoundary = (unsigned char)( g_markovStates - 1 );
+
+  const int g_markovMaxOrder = 3;
+  const int g_markovMaxLength = 64;
+
+  const char g_markovFileMagic[4] = { 'C', 'H', 'R', 'M' };
+
+  const unsigned int g_markovFileVersion = 1;
+
+  inline unsigned char markovState( Degree degree, ChordType type )
+  {
+    return (unsigned char)( degree * g_markovChordTypes + type );
+  }
+
+  // Number of runs of states of a length
+  inline size_t markovContexts( int order )
+  {
+    size_t contexts = 1;
+    for ( int i = 0; i < order; i++ )
+      contexts *= g_markovStates;
+    return contexts;
+  }
+
+  // States of the steps of a stored progression. Plain steps carry their
+  // degree and chord type as they are; only extended ones are decoded.
+  inline void markovStates( const PackedProgression& progression, ChordProgressionStep& step, vector<unsigned char>& states )
+  {
+    states.clear();
+    for ( const unsigned char* pos = progression.steps, *end = pos + progression.size; pos < end; )
+    {
+      if ( ( *pos & 7 ) != g_stepExtended ) {
+        states.push_back( markovState( (Degree)( *pos & 7 ), (ChordType)( ( *pos >> 3 ) & 7 ) ) );
+        pos++;
+        continue;
+      }
+      decodeStep( progression.scale, pos, step );
+      states.push_back( markovState( step.degree, step.chord.type ) );
+    }
+  }
+
+  // Transition counts of every order up to that of the model, one row of
+  // counts per run of states. The most recent state of a run is its
+  // lowest digit in base g_markovStates.
+
+  template <class Count>
+  class MarkovCounts {
+  protected:
+    int order;
+    vector<Count> counts;
+    size_t offsets[g_markovMaxOrder + 2];
+  public:
+    explicit MarkovCounts( int _order = 1 )
+    {
+      reset( _order );
+    }
+    void reset( int _order )
+    {
+      order = _order;
+      offsets[1] = 0;
+      for ( int j = 1; j <= order; j++ )
+        offsets[j + 1] = offsets[j] + markovContexts( j ) * g_markovStates;
+      counts.assign( offsets[order + 1], 0 );
+    }
+    int getOrder() const
+    {
+      return order;
+    }
+    size_t getCells() const
+    {
+      return counts.size();
+    }
+    const Count* getCounts() const
+    {
+      return counts.empty() ? NULL : &counts[0];
+    }
+    Count* getRow( int runLength, size_t context )
+    {
+      return &counts[offsets[runLength] + context * g_markovStates];
+    }
+    const Count* getRow( int runLength, size_t context ) const
+    {
+      return &counts[offsets[runLength] + context * g_markovStates];
+    }
+    void add( const unsigned char* states, size_t length )
+    {
+      unsigned char history[g_markovMaxOrder];
+      memset( history, g_markovBoundary, sizeof( history ) );
+      for ( size_t i = 0; i <= length; i++ )
+      {
+        unsigned char next = i < length ? states[i] : g_markovBoundary;
+        size_t context = 0, digit = 1;
+        for ( int j = 1; j <= order; j++ )
+        {
+          context += history[j - 1] * digit;
+          digit *= g_markovStates;
+          counts[offsets[j] + context * g_markovStates + next]++;
+        }
+        memmove( history + 1, history, g_markovMaxOrder - 1 );
+        history[0] = next;
+      }
+    }
+    // Adds the counts of a range of cells of another table of the same order
+    template <class Other>
+    void merge( const MarkovCounts<Other>& other, size_t first, size_t last )
+    {
+      const Other* source = other.getCounts();
+      for ( size_t i = first; i < last; i++ )
+        counts[i] += source[i];
+    }
+  };
+
+  typedef MarkovCounts<unsigned long long> MarkovModel;
+
+  // Counts the transitions of every progression in a file, a block at a
+  // time on a pool of threads that each keep a table of their own, then
+  // adds the tables together a range of cells per thread. 32-bit tables
+  // do for files too small for any count to overflow. Fails if the file
+  // is corrupt.
+
+  template <class Count>
+  bool trainMarkovModel( const ProgressionFileReader& file, size_t threads, MarkovModel& model )
+  {
+    vector<MarkovCounts<Count> > tables( threads, MarkovCounts<Count>( model.getOrder() ) );
+    std::atomic<bool> corrupt( false );
+    {
+      ThreadPool pool( threads );
+      for ( size_t block = 0; block < file.getBlockCount(); block++ )
+      {
+        pool.submit( [&, block]() {
+          MarkovCounts<Count>& counts = tables[ThreadPool::currentWorker()];
+          ProgressionCursor cursor = file.getBlock( block );
+          PackedProgression progression;
+          ChordProgressionStep step( Degree_Tonic, Triad() );
+          vector<unsigned char> states;
+          while ( cursor.next( progression ) )
+          {
+            markovStates( progression, step, states );
+            counts.add( &states[0], states.size() );
+          }
+          if ( cursor.isCorrupt() )
+            corrupt = true;
+        } );
+      }
+    }
+    if ( corrupt )
+      return false;
+    {
+      ThreadPool pool( threads );
+      size_t ranges = threads * 4;
+      for ( size_t r = 0; r < ranges; r++ )
+      {
+        pool.submit( [&, r]() {
+          for ( size_t t = 0; t < tables.size(); t++ )
+            model.merge( tables[t], r * model.getCells() / ranges, ( r + 1 ) * model.getCells() / ranges );
+        } );
+      }
+    }
+    return true;
+  }
+
+  // Model files hold the rows of counts that are not all zero, each as its
+  // run of states and its nonzero counts, with variable-length numbers.
+
+  struct MarkovFileHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int order;
+    unsigned int states;
+    unsigned long long progressions;
+    unsigned long long size;
+  };
+
+  inline void appendMarkovNumber( unsigned long long value, vector<unsigned char>& output )
+  {
+    for ( ; value >= 0x80; value >>= 7 )
+      output.push_back( (unsigned char)( value | 0x80 ) );
+    output.push_back( (unsigned char)value );
+  }
+
+  inline bool readMarkovNumber( const unsigned char*& pos, const unsigned char* end, unsigned long long& value )
+  {
+    value = 0;
+    for ( int shift = 0; pos < end && shift < 64; shift += 7 )
+    {
+      unsigned char c = *pos++;
+      value |= (unsigned long long)( c & 0x7F ) << shift;
+      if ( !( c & 0x80 ) )
+        return true;
+    }
+    return false;
+  }
+
+  // Saves a model; false if the file cannot be written
+  bool saveMarkovModel( const MarkovModel& model, unsigned long long progressions, const string& path )
+  {
+    vector<unsigned char> data;
+    for ( int j = 1; j <= model.getOrder(); j++ )
+    {
+      size_t contexts = markovContexts( j ), rows = 0;
+      vector<unsigned char> rowData;
+      for ( size_t context = 0; context < contexts; context++ )
+      {
+        const unsigned long long* row = model.getRow( j, context );
+        unsigned int nonzero = 0;
+        for ( unsigned int s = 0; s < g_markovStates; s++ )
+          nonzero += row[s] ? 1 : 0;
+        if ( !nonzero )
+          continue;
+        rows++;
+        appendMarkovNumber( context, rowData );
+        rowData.push_back( (unsigned char)nonzero );
+        for ( unsigned int s = 0; s < g_markovStates; s++ )
+        {
+          if ( !row[s] )
+            continue;
+          rowData.push_back( (unsigned char)s );
+          appendMarkovNumber( row[s], rowData );
+        }
+      }
+      appendMarkovNumber( rows, data );
+      data.insert( data.end(), rowData.begin(), rowData.end() );
+    }
+    MarkovFileHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, g_markovFileMagic, 4 );
+    header.version = g_markovFileVersion;
+    header.order = (unsigned int)model.getOrder();
+    header.states = g_markovStates;
+    header.progressions = progressions;
+    header.size = data.size();
+    return saveFile( path, [&]( FILE* file ) {
+      return fwrite( &header, sizeof( header ), 1, file ) == 1
+        && ( data.empty() || fwrite( &data[0], 1, data.size(), file ) == data.size() );
+    } );
+  }
+
+  // Loads a model; false if the file cannot be read or is not a model
+  bool loadMarkovModel( const string& path, MarkovModel& model, unsigned long long& progressions )
+  {
+    MappedFile file;
+    MarkovFileHeader header;
+    if ( !file.open( path ) || file.getSize() < sizeof( header ) )
+      return false;
+    memcpy( &header, file.getData(), sizeof( header ) );
+    if ( memcmp( header.magic, g_markovFileMagic, 4 ) || header.version != g_markovFileVersion
+      || header.order < 1 || header.order > (unsigned int)g_markovMaxOrder || header.states != g_markovStates
+      || header.size != file.getSize() - sizeof( header ) )
+      return false;
+    model.reset( (int)header.order );
+    progressions = header.progressions;
+    const unsigned char* pos = file.getData() + sizeof( header );
+    const unsigned char* end = pos + header.size;
+    for ( int j = 1; j <= model.getOrder(); j++ )
+    {
+      unsigned long long rows, context, count;
+      if ( !readMarkovNumber( pos, end, rows ) )
+        return false;
+      for ( unsigned long long r = 0; r < rows; r++ )
+      {
+        if ( !readMarkovNumber( pos, end, context ) || context >= markovContexts( j ) || pos >= end )
+          return false;
+        unsigned long long* row = model.getRow( j, (size_t)context );
+        for ( unsigned int nonzero = *pos++; nonzero > 0; nonzero-- )
+        {
+          if ( pos >= end || *pos >= g_markovStates )
+            return false;
+          unsigned char state = *pos++;
+          if ( !readMarkovNumber( pos, end, count ) )
+            return false;
+          row[state] = count;
+        }
+      }
+    }
+    return pos == end;
+  }
+
+  // SplitMix64: a 64-bit counter through a strong mixing function. Small
+  // and fast, with streams that are far apart for different seeds.
+
+  class SplitMix {
+  protected:
+    unsigned long long state;
+  public:
+    explicit SplitMix( unsigned long long seed ): state( seed )
+    {
+    }
+    unsigned long long next()
+    {
+      unsigned long long z = ( state += 0x9E3779B97F4A7C15ULL );
+      z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+      z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+      return z ^ ( z >> 31 );
+    }
+  };
+
+  // Draws progressions from a model in a scale. States the scale cannot
+  // spell as a step are left out: degrees it does not have, and major or
+  // minor chords other than its own triad on a degree. Every row is turned
+  // into an alias table, so each step costs a single random number.
+
+  class MarkovSampler {
+  protected:
+    struct Row {
+      unsigned int start;
+      unsigned int size;
+    };
+    Scale scale;
+    int order;
+    vector<Row> rows[g_markovMaxOrder + 1];
+    vector<unsigned int> thresholds;
+    vector<unsigned char> columns;
+    vector<unsigned char> aliases;
+    string names[g_markovStates];
+    vector<double> weights;
+    vector<unsigned int> small;
+    vector<unsigned int> large;
+    bool spellable( unsigned int state, ChordProgressionStep& step ) const
+    {
+      if ( state == g_markovBoundary )
+        return true;
+      Degree degree = (Degree)( state / g_markovChordTypes );
+      ChordType type = (ChordType)( state % g_markovChordTypes );
+      if ( degree >= scale.getDegreeCount() )
+        return false;
+      step = ChordProgressionStep( degree, Triad( scale.getNotes()[degree], type ) );
+      if ( scale.hasTriad( degree ) && scale.getTriad( degree ).type == type )
+        return true;
+      for ( int quality = StepQuality_Diminished; quality <= StepQuality_SuspendedSecond; quality++ )
+      {
+        if ( g_stepQualityChords[quality] == type ) {
+          step.quality = (StepQuality)quality;
+          step.numeral.upper = type != ChordType_Diminished;
+          return true;
+        }
+      }
+      return false;
+    }
+    // Vose's alias method over the spellable states of a row of counts
+    void addRow( const unsigned long long* counts, const bool* allowed, Row& row )
+    {
+      row.start = (unsigned int)columns.size();
+      double total = 0.0;
+      for ( unsigned int s = 0; s < g_markovStates; s++ )
+      {
+        if ( !counts[s] || !allowed[s] )
+          continue;
+        columns.push_back( (unsigned char)s );
+        total += (double)counts[s];
+      }
+      row.size = (unsigned int)columns.size() - row.start;
+      if ( !row.size )
+        return;
+      weights.clear();
+      small.clear();
+      large.clear();
+      for ( unsigned int i = 0; i < row.size; i++ )
+      {
+        weights.push_back( (double)counts[columns[row.start + i]] * row.size / total );
+        ( weights[i] < 1.0 ? small : large ).push_back( i );
+      }
+      thresholds.resize( columns.size(), 0xFFFFFFFF );
+      aliases.resize( columns.size() );
+      for ( unsigned int i = 0; i < row.size; i++ )
+        aliases[row.start + i] = columns[row.start + i];
+      while ( !small.empty() && !large.empty() )
+      {
+        unsigned int less = small.back(), more = large.back();
+        small.pop_back();
+        thresholds[row.start + less] = (unsigned int)( weights[less] * 4294967295.0 );
+        aliases[row.start + less] = columns[row.start + more];
+        weights[more] -= 1.0 - weights[less];
+        if ( weights[more] < 1.0 ) {
+          large.pop_back();
+          small.push_back( more );
+        }
+      }
+    }
+  public:
+    MarkovSampler( const MarkovModel& model, const Scale& _scale ): scale( _scale ), order( model.getOrder() )
+    {
+      bool allowed[g_markovStates];
+      ChordProgressionStep step( Degree_Tonic, Triad() );
+      for ( unsigned int s = 0; s < g_markovStates; s++ )
+      {
+        allowed[s] = spellable( s, step );
+        if ( allowed[s] && s != g_markovBoundary )
+          appendStep( scale, step, names[s] );
+      }
+      for ( int j = 1; j <= order; j++ )
+      {
+        rows[j].resize( markovContexts( j ) );
+        for ( size_t context = 0; context < rows[j].size(); context++ )
+          addRow( model.getRow( j, context ), allowed, rows[j][context] );
+      }
+    }
+    // Whether the model has any progression the scale can spell
+    bool isEmpty() const
+    {
+      const Row& start = rows[1][g_markovBoundary];
+      for ( unsigned int i = 0; i < start.size; i++ )
+        if ( columns[start.start + i] != g_markovBoundary )
+          return false;
+      return true;
+    }
+    // Draws the states of one progression of at most maxLength steps,
+    // following the longest run of previous states the model has seen
+    size_t sample( SplitMix& random, unsigned char* states, size_t maxLength ) const
+    {
+      size_t length = 0;
+      while ( length < maxLength )
+      {
+        const Row* row = NULL;
+        size_t context = 0, digit = 1;
+        for ( int j = 1; j <= order; j++ )
+        {
+          context += ( (size_t)j <= length ? states[length - j] : g_markovBoundary ) * digit;
+          digit *= g_markovStates;
+          if ( rows[j][context].size )
+            row = &rows[j][context];
+        }
+        if ( !row )
+          break;
+        unsigned long long r = random.next();
+        unsigned int column = row->start + (unsigned int)( ( ( r & 0xFFFFFFFF ) * row->size ) >> 32 );
+        unsigned char state = (unsigned int)( r >> 32 ) < thresholds[column] ? columns[column] : aliases[column];
+        if ( state == g_markovBoundary )
+          break;
+        states[length++] = state;
+      }
+      return length;
+    }
+    // Appends a progression of states in the form read by the progression
+    // action, such as "I-vi-IV-V C"
+    void append( const unsigned char* states, size_t length, string& str ) const
+    {
+      for ( size_t i = 0; i < length; i++ )
+      {
+        if ( i )
+          str.push_back( '-' );
+        str.append( names[states[i]] );
+      }
+      str.push_back( ' ' );
+      appendScaleShorthand( scale, str );
+    }
+  };
+
+}
\ No newline at end of file
@@ -0,0 +1,314 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticScaleIndex.h"
+
+namespace chromatic {
+
+  using std::vector;
+
+  // MIDI import errors
+
+  enum MidiResult: int {
+    Midi_OK = 0,
+    Midi_NotMidi,
+    Midi_Truncated,
+    Midi_SmpteTiming,
+    Midi_TooLong,
+    Midi_NoNotes
+  };
+
+  const char* g_midiResultsStr[6] = {
+    "no error",
+    "not a standard MIDI file",
+    "truncated or corrupt MIDI data",
+    "SMPTE time division is not supported",
+    "too long to analyze",
+    "no notes found"
+  };
+
+  // Ticks each pitch class sounds for within a window of time
+
+  struct PitchProfile {
+    unsigned long long weights[12];
+  };
+
+  typedef vector<PitchProfile> ProfileVector;
+
+  // A chord held for a number of consecutive windows
+
+  struct MidiChord {
+    Triad chord;
+    unsigned int windows;
+  };
+
+  typedef vector<MidiChord> MidiChordVector;
+
+  struct MidiAnalysis {
+    unsigned int windowTicks;
+    unsigned int windows;
+    MidiChordVector chords;
+    Scale scale;
+  };
+
+  const unsigned int g_midiMaxWindows = 1 << 20;
+
+  const int g_midiPercussionChannel = 9;
+
+  // The triad that best covers a profile: sounding time on chord tones
+  // counts for it and time on other notes against it, with the time on the
+  // root breaking ties. Ties beyond that go to the earlier chord type in
+  // g_scaleTriadOrder.
+
+  inline bool recognizeTriad( const PitchProfile& profile, Triad& chord )
+  {
+    const unsigned long long* w = profile.weights;
+    unsigned long long total = 0;
+    for ( int i = 0; i < 12; i++ )
+      total += w[i];
+    if ( !total )
+      return false;
+    long long best = 0;
+    bool found = false;
+    for ( int i = 0; i < 6; i++ )
+    {
+      ChordType type = g_scaleTriadOrder[i];
+      for ( int root = Note_C; root <= Note_B; root++ )
+      {
+        const Note* notes = g_triadNotes[root][type];
+        long long inside = (long long)( w[notes[0]] + w[notes[1]] + w[notes[2]] );
+        long long score = 4 * inside - 2 * (long long)total + (long long)w[root];
+        if ( !found || score > best ) {
+          best = score;
+          chord = Triad( (Note)root, type );
+          found = true;
+        }
+      }
+    }
+    return true;
+  }
+
+  // The major or minor scale that holds the recognized chords for the
+  // longest time, counting time on its own tonic triad twice
+
+  inline Scale detectScale( const MidiChordVector& chords )
+  {
+    unsigned long long scores[24];
+    memset( scores, 0, sizeof( scores ) );
+    for ( MidiChordVector::const_iterator it = chords.begin(); it != chords.end(); ++it )
+    {
+      ScaleSet scales = scalesContaining( (*it).chord );
+      for ( int bit = 0; bit < 24; bit++ )
+        if ( scales & ( 1u << bit ) )
+          scores[bit] += (*it).windows;
+      if ( (*it).chord.type == ChordType_Major )
+        scores[ScaleMode_Major * 12 + (*it).chord.first] += (*it).windows;
+      else if ( (*it).chord.type == ChordType_Minor )
+        scores[ScaleMode_Minor * 12 + (*it).chord.first] += (*it).windows;
+    }
+    Scale best;
+    unsigned long long bestScore = 0;
+    for ( int mode = ScaleMode_Major; mode >= ScaleMode_Minor; mode-- )
+      for ( int root = Note_C; root <= Note_B; root++ )
+        if ( scores[mode * 12 + root] > bestScore ) {
+          bestScore = scores[mode * 12 + root];
+          best = Scale( (Note)root, (ScaleMode)mode );
+        }
+    return best;
+  }
+
+  // Reads Standard MIDI Files straight from memory, track by track. Every
+  // note adds its sounding time to the pitch class profiles of the windows
+  // it overlaps, so tracks never need to be merged into one timeline.
+  // Buffers are kept between files.
+
+  class MidiAnalyzer {
+  protected:
+    ProfileVector profiles;
+    unsigned long long starts[16][128];
+    bool sounding[16][128];
+    unsigned long long windowTicks;
+    static bool readLength( const unsigned char*& pos, const unsigned char* end, unsigned int& value )
+    {
+      value = 0;
+      for ( int i = 0; i < 4; i++ )
+      {
+        if ( pos >= end )
+          return false;
+        unsigned char c = *pos++;
+        value = ( value << 7 ) | ( c & 0x7F );
+        if ( !( c & 0x80 ) )
+          return true;
+      }
+      return false;
+    }
+    static unsigned int readBigEndian( const unsigned char* pos, int bytes )
+    {
+      unsigned int value = 0;
+      for ( int i = 0; i < bytes; i++ )
+        value = ( value << 8 ) | pos[i];
+      return value;
+    }
+    bool addNote( int key, unsigned long long start, unsigned long long stop )
+    {
+      if ( stop <= start )
+        return true;
+      unsigned long long last = ( stop - 1 ) / windowTicks;
+      if ( last >= g_midiMaxWindows )
+        return false;
+      if ( profiles.size() <= last ) {
+        PitchProfile empty;
+        memset( &empty, 0, sizeof( empty ) );
+        profiles.resize( (size_t)last + 1, empty );
+      }
+      Note note = (Note)( key % Interval_Octave );
+      for ( unsigned long long window = start / windowTicks; window <= last; window++ )
+      {
+        unsigned long long from = std::max( start, window * windowTicks );
+        unsigned long long to = std::min( stop, ( window + 1 ) * windowTicks );
+        profiles[(size_t)window].weights[note] += to - from;
+      }
+      return true;
+    }
+    MidiResult readTrack( const unsigned char* pos, const unsigned char* end )
+    {
+      memset( sounding, 0, sizeof( sounding ) );
+      unsigned long long ticks = 0;
+      unsigned char status = 0;
+      while ( pos < end )
+      {
+        unsigned int delta;
+        if ( !readLength( pos, end, delta ) )
+          return Midi_Truncated;
+        ticks += delta;
+        if ( pos >= end )
+          return Midi_Truncated;
+        if ( *pos & 0x80 )
+          status = *pos++;
+        if ( status == 0xFF ) {
+          unsigned int length;
+          if ( pos >= end )
+            return Midi_Truncated;
+          unsigned char type = *pos++;
+          if ( !readLength( pos, end, length ) || length > (size_t)( end - pos ) )
+            return Midi_Truncated;
+          pos += length;
+          status = 0;
+          if ( type == 0x2F )
+            break;
+        } else if ( status == 0xF0 || status == 0xF7 ) {
+          unsigned int length;
+          if ( !readLength( pos, end, length ) || length > (size_t)( end - pos ) )
+            return Midi_Truncated;
+          pos += length;
+          status = 0;
+        } else if ( status >= 0x80 && status < 0xF0 ) {
+          int kind = status & 0xF0;
+          int dataBytes = ( kind == 0xC0 || kind == 0xD0 ) ? 1 : 2;
+          if ( end - pos < dataBytes )
+            return Midi_Truncated;
+          int channel = status & 0x0F;
+          int key = pos[0] & 0x7F;
+          bool on = kind == 0x90 && pos[1] != 0;
+          bool off = kind == 0x80 || ( kind == 0x90 && pos[1] == 0 );
+          pos += dataBytes;
+          if ( channel == g_midiPercussionChannel || !( on || off ) )
+            continue;
+          if ( sounding[channel][key] && !addNote( key, starts[channel][key], ticks ) )
+            return Midi_TooLong;
+          sounding[channel][key] = on;
+          starts[channel][key] = ticks;
+        } else
+          return Midi_Truncated;
+      }
+      for ( int channel = 0; channel < 16; channel++ )
+        for ( int key = 0; key < 128; key++ )
+          if ( sounding[channel][key] && !addNote( key, starts[channel][key], ticks ) )
+            return Midi_TooLong;
+      return Midi_OK;
+    }
+  public:
+    MidiAnalyzer(): windowTicks( 1 )
+    {
+    }
+    // Labels each window of the given number of beats with a triad, merges
+    // repeated chords and finds the scale. Windows with no notes extend
+    // the chord before them.
+    MidiResult analyze( const unsigned char* data, size_t size, unsigned int beats, MidiAnalysis& analysis )
+    {
+      profiles.clear();
+      analysis.chords.clear();
+      if ( size < 14 || memcmp( data, "MThd", 4 ) )
+        return Midi_NotMidi;
+      unsigned int headerLength = readBigEndian( data + 4, 4 );
+      if ( headerLength < 6 || headerLength > size - 8 )
+        return Midi_NotMidi;
+      unsigned int division = readBigEndian( data + 12, 2 );
+      if ( division & 0x8000 )
+        return Midi_SmpteTiming;
+      if ( !division )
+        return Midi_NotMidi;
+      windowTicks = (unsigned long long)division * beats;
+      const unsigned char* pos = data + 8 + headerLength;
+      const unsigned char* end = data + size;
+      while ( end - pos >= 8 )
+      {
+        unsigned int length = readBigEndian( pos + 4, 4 );
+        if ( length > (size_t)( end - pos - 8 ) )
+          return Midi_Truncated;
+        if ( !memcmp( pos, "MTrk", 4 ) ) {
+          MidiResult result = readTrack( pos + 8, pos + 8 + length );
+          if ( result != Midi_OK )
+            return result;
+        }
+        pos += 8 + length;
+      }
+      analysis.windowTicks = (unsigned int)windowTicks;
+      analysis.windows = (unsigned int)profiles.size();
+      for ( size_t window = 0; window < profiles.size(); window++ )
+      {
+        Triad chord;
+        if ( !recognizeTriad( profiles[window], chord ) ) {
+          if ( !analysis.chords.empty() )
+            analysis.chords.back().windows++;
+          continue;
+        }
+        MidiChordVector& chords = analysis.chords;
+        if ( !chords.empty() && chords.back().chord.first == chord.first && chords.back().chord.type == chord.type )
+          chords.back().windows++;
+        else {
+          MidiChord entry = { chord, 1 };
+          chords.push_back( entry );
+        }
+      }
+      if ( analysis.chords.empty() )
+        return Midi_NoNotes;
+      analysis.scale = detectScale( analysis.chords );
+      return Midi_OK;
+    }
+  };
+
+}
\ No newline at end of file
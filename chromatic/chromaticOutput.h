@@ -0,0 +1,868 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+
+#include "chromaticTypes.h"
+#include "chromaticStats.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticPitchClassSet.h"
+#include "chromaticScaleIndex.h"
+#include "chromaticParser.h"
+#include "chromaticVoicing.h"
+#include "chromaticMidi.h"
+#include "chromaticKey.h"
+#include "chromaticProgressionFile.h"
+
+namespace chromatic {
+
+  using std::string;
+
+  enum OutputFormat: unsigned char {
+    OutputFormat_Text = 0,
+    OutputFormat_Json,
+    OutputFormat_Csv
+  };
+
+  const char* g_outputFormatsStr[3] = {
+    "text", "json", "csv"
+  };
+
+  // Formats results into a reusable buffer that is written out in large
+  // blocks. Text is meant for people, JSON Lines emits one object per result
+  // and CSV emits rows of type,scale,degree,chord,notes,detail.
+
+  class OutputWriter {
+  protected:
+    OutputFormat format;
+    FILE* stream;
+    FILE* errorStream;
+    string* errorBuffer;
+    size_t flushSize;
+    string buffer;
+    void put( const char* str )
+    {
+      buffer.append( str );
+    }
+    void put( const StringView& str )
+    {
+      buffer.append( str.data(), str.length() );
+    }
+    void put( char c )
+    {
+      buffer.push_back( c );
+    }
+    // Escapes a string for the inside of a JSON string
+    void putEscaped( const StringView& str )
+    {
+      for ( size_t i = 0; i < str.length(); i++ )
+      {
+        char c = str[i];
+        if ( c == '"' || c == '\\' ) {
+          put( '\\' );
+          put( c );
+        } else if ( (unsigned char)c < 0x20 ) {
+          const char* hex = "0123456789abcdef";
+          put( "\\u00" );
+          put( hex[c >> 4] );
+          put( hex[c & 0xF] );
+        } else
+          put( c );
+      }
+    }
+    void putQuoted( const StringView& str )
+    {
+      if ( format == OutputFormat_Csv ) {
+        if ( str.find_first_of( ",\"\r\n" ) == StringView::npos ) {
+          put( str );
+          return;
+        }
+        put( '"' );
+        for ( size_t i = 0; i < str.length(); i++ )
+        {
+          if ( str[i] == '"' )
+            put( '"' );
+          put( str[i] );
+        }
+        put( '"' );
+        return;
+      }
+      put( '"' );
+      putEscaped( str );
+      put( '"' );
+    }
+    // Scale names come from mode definitions and may hold any character,
+    // so they are escaped inside JSON strings and quoted as CSV fields
+    void putName( const StringView& name )
+    {
+      if ( format == OutputFormat_Json )
+        putEscaped( name );
+      else if ( format == OutputFormat_Csv )
+        putQuoted( name );
+      else
+        put( name );
+    }
+    void putNotes( const Note* notes, int count, char delimiter )
+    {
+      for ( int i = 0; i < count; i++ )
+      {
+        if ( i )
+          put( delimiter );
+        if ( format == OutputFormat_Json )
+          put( '"' );
+        put( g_notesSharpStr[notes[i]] );
+        if ( format == OutputFormat_Json )
+          put( '"' );
+      }
+    }
+    void putTriadNotes( const Triad& chord )
+    {
+      Note notes[3] = { chord.first, chord.second, chord.third };
+      if ( format == OutputFormat_Json ) {
+        put( '[' );
+        putNotes( notes, 3, ',' );
+        put( ']' );
+      } else
+        put( chord.getString() );
+    }
+    void putPitch( Pitch pitch )
+    {
+      if ( format == OutputFormat_Json )
+        put( '"' );
+      put( g_notesSharpStr[pitchClass( pitch )] );
+      put( std::to_string( (long long)pitchOctave( pitch ) ).c_str() );
+      if ( format == OutputFormat_Json )
+        put( '"' );
+    }
+    void putVoicing( const Voicing& voicing )
+    {
+      if ( format == OutputFormat_Json )
+        put( '[' );
+      for ( int i = 0; i < 3; i++ )
+      {
+        if ( i )
+          put( format == OutputFormat_Json ? ',' : '-' );
+        putPitch( voicing.voices[i] );
+      }
+      if ( format == OutputFormat_Json )
+        put( ']' );
+    }
+    void putMidiChords( const MidiChordVector& chords, char delimiter )
+    {
+      for ( size_t i = 0; i < chords.size(); i++ )
+      {
+        if ( i )
+          put( delimiter );
+        if ( format == OutputFormat_Json )
+          put( '"' );
+        put( g_notesSharpStr[chords[i].chord.first] );
+        put( g_chordsSuffixStr[chords[i].chord.type] );
+        if ( format == OutputFormat_Json )
+          put( '"' );
+      }
+    }
+    void putMidiNumerals( const Scale& scale, const MidiChordVector& chords )
+    {
+      for ( size_t i = 0; i < chords.size(); i++ )
+      {
+        if ( i )
+          put( '-' );
+        const char* numeral = "?";
+        for ( Degree degree = Degree_Tonic; degree < scale.getDegreeCount(); ++degree )
+        {
+          Triad triad = scale.getTriad( degree );
+          if ( scale.hasTriad( degree ) && triad.first == chords[i].chord.first && triad.type == chords[i].chord.type ) {
+            numeral = scale.getDegree( degree );
+            break;
+          }
+        }
+        put( numeral );
+      }
+    }
+    // Correlation with three decimals
+    string formatCorrelation( float correlation )
+    {
+      long thousandths = (long)floor( fabs( correlation ) * 1000.0f + 0.5f );
+      string str = correlation < 0.0f && thousandths ? "-" : "";
+      str.append( std::to_string( (long long)( thousandths / 1000 ) ) );
+      str.push_back( '.' );
+      str.push_back( (char)( '0' + thousandths / 100 % 10 ) );
+      str.push_back( (char)( '0' + thousandths / 10 % 10 ) );
+      str.push_back( (char)( '0' + thousandths % 10 ) );
+      return str;
+    }
+    void putCsvRow( const char* type, const char* scale, const char* degree, const char* chord, const char* notes, const StringView& detail )
+    {
+      put( type );
+      put( ',' );
+      putName( scale );
+      put( ',' );
+      put( degree );
+      put( ',' );
+      put( chord );
+      put( ',' );
+      put( notes );
+      put( ',' );
+      putQuoted( detail );
+      endRecord();
+    }
+    void putProgressionNumerals( const ChordProgression& progression )
+    {
+      const ProgressionVector& steps = progression.getSteps();
+      for ( ProgressionVector::const_iterator it = steps.begin(); it != steps.end(); ++it )
+      {
+        if ( it != steps.begin() )
+          put( '-' );
+        appendStep( progression.getScale(), *it, buffer );
+      }
+    }
+    void putStepNotes( const ChordProgressionStep& step, char delimiter )
+    {
+      Note notes[3];
+      step.getVoicedNotes( notes );
+      if ( format == OutputFormat_Json )
+        put( '[' );
+      putNotes( notes, 3, delimiter );
+      if ( format == OutputFormat_Json )
+        put( ']' );
+    }
+    void endRecord()
+    {
+      put( '\n' );
+      if ( stream && buffer.length() >= flushSize )
+        flush();
+    }
+  public:
+    explicit OutputWriter( OutputFormat _format, FILE* _stream = stdout, size_t _flushSize = 1 << 16 ):
+    format( _format ), stream( _stream ), errorStream( stderr ), errorBuffer( NULL ), flushSize( _flushSize )
+    {
+      buffer.reserve( flushSize + 1024 );
+    }
+    // Text errors go to standard error unless set, or into the output
+    // with the rest of the results if NULL
+    void setErrorStream( FILE* _errorStream )
+    {
+      errorStream = _errorStream;
+    }
+    // Collects text errors meant for the error stream here instead while
+    // set, so that the caller can write them out in order with the results
+    void setErrorBuffer( string* _errorBuffer )
+    {
+      errorBuffer = _errorBuffer;
+    }
+    ~OutputWriter()
+    {
+      flush();
+    }
+    OutputFormat getFormat() const
+    {
+      return format;
+    }
+    string& getBuffer()
+    {
+      return buffer;
+    }
+    void flush()
+    {
+      if ( !stream || buffer.empty() )
+        return;
+      CHROMATIC_STATS_SCOPE( Stats_Flush );
+      fputs( buffer.c_str(), stream );
+      buffer.clear();
+    }
+    void writeHeader()
+    {
+      if ( format == OutputFormat_Csv ) {
+        put( "type,scale,degree,chord,notes,detail" );
+        endRecord();
+      }
+    }
+    void writeChord( const Triad& chord )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Chord " );
+          put( chord.getName() );
+          put( ":\n- " );
+          put( chord.getString() );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"chord\",\"name\":\"" );
+          put( chord.getName() );
+          put( "\",\"notes\":" );
+          putTriadNotes( chord );
+          put( '}' );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "chord", "", "", chord.getName(), chord.getString(), StringView() );
+        break;
+      }
+    }
+    void writeScale( const Scale& scale )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Scale " );
+          putName( scale.getName() );
+          put( ":\n- " );
+          put( scale.getString() );
+          put( "\nChords in " );
+          putName( scale.getName() );
+          put( ':' );
+          for ( Degree i = Degree_Tonic; i < scale.getDegreeCount(); ++i )
+          {
+            put( "\n- " );
+            put( scale.hasTriad( i ) ? scale.getTriad( i ).getName() : "No triad" );
+          }
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"scale\",\"name\":\"" );
+          putName( scale.getName() );
+          put( "\",\"notes\":[" );
+          putNotes( scale.getNotes(), scale.getDegreeCount(), ',' );
+          put( "],\"chords\":[" );
+          for ( Degree i = Degree_Tonic; i < scale.getDegreeCount(); ++i )
+          {
+            Triad chord = scale.getTriad( i );
+            put( i == Degree_Tonic ? "{\"degree\":\"" : ",{\"degree\":\"" );
+            put( scale.getDegree( i ) );
+            if ( !scale.hasTriad( i ) ) {
+              put( "\",\"name\":null,\"notes\":null}" );
+              continue;
+            }
+            put( "\",\"name\":\"" );
+            put( chord.getName() );
+            put( "\",\"notes\":" );
+            putTriadNotes( chord );
+            put( '}' );
+          }
+          put( "]}" );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "scale", scale.getName(), "", "", scale.getString(), StringView() );
+          for ( Degree i = Degree_Tonic; i < scale.getDegreeCount(); ++i )
+          {
+            Triad chord = scale.getTriad( i );
+            bool found = scale.hasTriad( i );
+            putCsvRow( "scale", scale.getName(), scale.getDegree( i ), found ? chord.getName() : "", found ? chord.getString() : "", StringView() );
+          }
+        break;
+      }
+    }
+    void writeProgression( const ChordProgression& progression )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      const Scale& scale = progression.getScale();
+      const ProgressionVector& steps = progression.getSteps();
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Chord progression " );
+          putProgressionNumerals( progression );
+          put( " in " );
+          putName( scale.getName() );
+          put( ':' );
+          for ( ProgressionVector::const_iterator it = steps.begin(); it != steps.end(); ++it )
+          {
+            put( "\n- " );
+            put( (*it).chord.getName() );
+            if ( (*it).inversion != Inversion_Root ) {
+              put( ", " );
+              put( g_inversionsStr[(*it).inversion] );
+            }
+            put( "\n  " );
+            putStepNotes( *it, '-' );
+          }
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"progression\",\"progression\":\"" );
+          putProgressionNumerals( progression );
+          put( "\",\"scale\":\"" );
+          putName( scale.getName() );
+          put( "\",\"chords\":[" );
+          for ( ProgressionVector::const_iterator it = steps.begin(); it != steps.end(); ++it )
+          {
+            put( it == steps.begin() ? "{\"degree\":\"" : ",{\"degree\":\"" );
+            appendStep( scale, *it, buffer );
+            put( "\",\"name\":\"" );
+            put( (*it).chord.getName() );
+            if ( (*it).inversion != Inversion_Root ) {
+              put( "\",\"inversion\":\"" );
+              put( g_inversionsStr[(*it).inversion] );
+            }
+            put( "\",\"notes\":" );
+            putStepNotes( *it, ',' );
+            put( '}' );
+          }
+          put( "]}" );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          for ( ProgressionVector::const_iterator it = steps.begin(); it != steps.end(); ++it )
+          {
+            put( "progression," );
+            putName( scale.getName() );
+            put( ',' );
+            appendStep( scale, *it, buffer );
+            put( ',' );
+            put( (*it).chord.getName() );
+            put( ',' );
+            putStepNotes( *it, '-' );
+            put( ',' );
+            if ( (*it).inversion != Inversion_Root )
+              put( g_inversionsStr[(*it).inversion] );
+            endRecord();
+          }
+        break;
+      }
+    }
+    void writeIdentity( const StringView& notes, bool found, const Triad& chord, Inversion inversion )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Notes " );
+          put( notes );
+          if ( found ) {
+            put( ":\n- " );
+            put( chord.getName() );
+            put( ", " );
+            put( g_inversionsStr[inversion] );
+            put( "\n  " );
+            put( chord.getString() );
+          } else
+            put( ":\n- No matching triad" );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"identify\",\"notes\":" );
+          putQuoted( notes );
+          if ( found ) {
+            put( ",\"chord\":{\"name\":\"" );
+            put( chord.getName() );
+            put( "\",\"inversion\":\"" );
+            put( g_inversionsStr[inversion] );
+            put( "\",\"notes\":" );
+            putTriadNotes( chord );
+            put( "}}" );
+          } else
+            put( ",\"chord\":null}" );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "identify", "", "", found ? chord.getName() : "", found ? chord.getString() : "",
+            found ? g_inversionsStr[inversion] : "" );
+        break;
+      }
+    }
+    void writeKeys( const StringView& chords, ScaleSet scales )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Keys containing " );
+          put( chords );
+          put( ':' );
+          if ( !scales )
+            put( "\n- None" );
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"keys\",\"chords\":" );
+          putQuoted( chords );
+          put( ",\"keys\":[" );
+        break;
+        case OutputFormat_Csv:
+        break;
+      }
+      bool first = true;
+      for ( int mode = ScaleMode_Major; mode >= ScaleMode_Minor; mode-- )
+        for ( int root = Note_C; root <= Note_B; root++ )
+        {
+          if ( !( scales & scaleBit( (Note)root, (ScaleMode)mode ) ) )
+            continue;
+          const char* name = Scale( (Note)root, (ScaleMode)mode ).getName();
+          if ( format == OutputFormat_Text ) {
+            put( "\n- " );
+            putName( name );
+          } else if ( format == OutputFormat_Json ) {
+            put( first ? "\"" : ",\"" );
+            putName( name );
+            put( '"' );
+          } else
+            putCsvRow( "keys", name, "", "", "", chords );
+          first = false;
+        }
+      if ( format == OutputFormat_Json )
+        put( "]}" );
+      if ( format != OutputFormat_Csv )
+        endRecord();
+    }
+    void writeKey( const StringView& notes, const KeyEstimateVector& estimates, size_t count )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Key of " );
+          put( notes );
+          put( ':' );
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"key\",\"notes\":" );
+          putQuoted( notes );
+          put( ",\"keys\":[" );
+        break;
+        case OutputFormat_Csv:
+        break;
+      }
+      for ( size_t i = 0; i < count && i < estimates.size(); i++ )
+      {
+        string correlation = formatCorrelation( estimates[i].correlation );
+        if ( format == OutputFormat_Text ) {
+          put( "\n- " );
+          putName( estimates[i].scale.getName() );
+          put( " (" );
+          put( correlation.c_str() );
+          put( ')' );
+        } else if ( format == OutputFormat_Json ) {
+          put( i ? ",{\"name\":\"" : "{\"name\":\"" );
+          putName( estimates[i].scale.getName() );
+          put( "\",\"correlation\":" );
+          put( correlation.c_str() );
+          put( '}' );
+        } else
+          putCsvRow( "key", estimates[i].scale.getName(), "", "", "", correlation );
+      }
+      if ( format == OutputFormat_Json )
+        put( "]}" );
+      if ( format != OutputFormat_Csv )
+        endRecord();
+    }
+    void writeModulation( unsigned long long position, const KeyEstimate& estimate )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      string note = std::to_string( position );
+      string correlation = formatCorrelation( estimate.correlation );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Note " );
+          put( note.c_str() );
+          put( ": " );
+          putName( estimate.scale.getName() );
+          put( " (" );
+          put( correlation.c_str() );
+          put( ')' );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"modulation\",\"note\":" );
+          put( note.c_str() );
+          put( ",\"key\":\"" );
+          putName( estimate.scale.getName() );
+          put( "\",\"correlation\":" );
+          put( correlation.c_str() );
+          put( '}' );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "modulation", estimate.scale.getName(), "", "", note.c_str(), correlation );
+        break;
+      }
+    }
+    void writeVoicing( const ChordProgression& progression, const VoicingVector& voicings, int movement )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      const Scale& scale = progression.getScale();
+      const ProgressionVector& steps = progression.getSteps();
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Voice leading for " );
+          putProgressionNumerals( progression );
+          put( " in " );
+          putName( scale.getName() );
+          put( " (" );
+          put( std::to_string( (long long)movement ).c_str() );
+          put( " semitones of movement):" );
+          for ( size_t i = 0; i < steps.size(); i++ )
+          {
+            put( "\n- " );
+            put( steps[i].chord.getName() );
+            put( ", " );
+            put( g_inversionsStr[voicings[i].getInversion( steps[i].chord )] );
+            put( "\n  " );
+            putVoicing( voicings[i] );
+          }
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"voicing\",\"progression\":\"" );
+          putProgressionNumerals( progression );
+          put( "\",\"scale\":\"" );
+          putName( scale.getName() );
+          put( "\",\"movement\":" );
+          put( std::to_string( (long long)movement ).c_str() );
+          put( ",\"chords\":[" );
+          for ( size_t i = 0; i < steps.size(); i++ )
+          {
+            put( i ? ",{\"degree\":\"" : "{\"degree\":\"" );
+            appendStep( scale, steps[i], buffer );
+            put( "\",\"name\":\"" );
+            put( steps[i].chord.getName() );
+            put( "\",\"inversion\":\"" );
+            put( g_inversionsStr[voicings[i].getInversion( steps[i].chord )] );
+            put( "\",\"notes\":" );
+            putVoicing( voicings[i] );
+            put( '}' );
+          }
+          put( "]}" );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          for ( size_t i = 0; i < steps.size(); i++ )
+          {
+            put( "voicing," );
+            putName( scale.getName() );
+            put( ',' );
+            appendStep( scale, steps[i], buffer );
+            put( ',' );
+            put( steps[i].chord.getName() );
+            put( ',' );
+            putVoicing( voicings[i] );
+            put( ',' );
+            put( g_inversionsStr[voicings[i].getInversion( steps[i].chord )] );
+            endRecord();
+          }
+        break;
+      }
+    }
+    void writeMidi( const StringView& path, const MidiAnalysis& analysis, unsigned int beats )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      string length = std::to_string( (unsigned long long)analysis.windows * beats );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "MIDI file " );
+          put( path );
+          put( " in " );
+          putName( analysis.scale.getName() );
+          put( ", " );
+          put( std::to_string( (unsigned long long)analysis.chords.size() ).c_str() );
+          put( " chords over " );
+          put( length.c_str() );
+          put( " beats:\n- " );
+          putMidiChords( analysis.chords, '-' );
+          put( "\n  " );
+          putMidiNumerals( analysis.scale, analysis.chords );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"midi\",\"file\":" );
+          putQuoted( path );
+          put( ",\"scale\":\"" );
+          putName( analysis.scale.getName() );
+          put( "\",\"beats\":" );
+          put( length.c_str() );
+          put( ",\"chords\":[" );
+          putMidiChords( analysis.chords, ',' );
+          put( "],\"durations\":[" );
+          for ( size_t i = 0; i < analysis.chords.size(); i++ )
+          {
+            if ( i )
+              put( ',' );
+            put( std::to_string( (unsigned long long)analysis.chords[i].windows * beats ).c_str() );
+          }
+          put( "],\"progression\":\"" );
+          putMidiNumerals( analysis.scale, analysis.chords );
+          put( "\"}" );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          put( "midi," );
+          putName( analysis.scale.getName() );
+          put( ',' );
+          putMidiNumerals( analysis.scale, analysis.chords );
+          put( ',' );
+          putMidiChords( analysis.chords, '-' );
+          put( ",," );
+          putQuoted( path );
+          endRecord();
+        break;
+      }
+    }
+    void writeGenerateSummary( const Scale& scale, int length, unsigned long long count )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "Progressions of length " );
+          put( std::to_string( (unsigned long long)length ).c_str() );
+          put( " in " );
+          putName( scale.getName() );
+          put( ": " );
+          put( std::to_string( count ).c_str() );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"generate\",\"scale\":\"" );
+          putName( scale.getName() );
+          put( "\",\"length\":" );
+          put( std::to_string( (unsigned long long)length ).c_str() );
+          put( ",\"count\":" );
+          put( std::to_string( count ).c_str() );
+          put( '}' );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "generate", scale.getName(), "", "", "", std::to_string( count ) );
+        break;
+      }
+    }
+    void writeGenerated( const Scale& scale, const Degree* degrees, int length )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( "- " );
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"generated\",\"scale\":\"" );
+          putName( scale.getName() );
+          put( "\",\"progression\":\"" );
+        break;
+        case OutputFormat_Csv:
+          put( "generated," );
+          putName( scale.getName() );
+          put( ',' );
+        break;
+      }
+      for ( int i = 0; i < length; i++ )
+      {
+        if ( i )
+          put( '-' );
+        put( scale.getDegree( degrees[i] ) );
+      }
+      if ( format == OutputFormat_Json )
+        put( "\"}" );
+      else if ( format == OutputFormat_Csv )
+        put( ",,," );
+      endRecord();
+    }
+    void writeFoundCount( unsigned long long count )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( std::to_string( count ).c_str() );
+          put( " progressions" );
+          endRecord();
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"find\",\"count\":" );
+          put( std::to_string( count ).c_str() );
+          put( '}' );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "find", "", "", "", "", std::to_string( count ) );
+        break;
+      }
+    }
+    // A progression found in a progression file, with its number there
+    void writeFound( unsigned long long id, const PackedProgression& progression )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      string number = std::to_string( id );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          put( number.c_str() );
+          put( ' ' );
+          appendPackedProgression( progression, buffer );
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"found\",\"id\":" );
+          put( number.c_str() );
+          put( ",\"progression\":\"" );
+          appendPackedSteps( progression, buffer );
+          put( "\",\"scale\":\"" );
+          putName( progression.scale.getName() );
+          put( "\"}" );
+        break;
+        case OutputFormat_Csv:
+          put( "found," );
+          putName( progression.scale.getName() );
+          put( ',' );
+          appendPackedSteps( progression, buffer );
+          put( ",,," );
+          put( number.c_str() );
+        break;
+      }
+      endRecord();
+    }
+    void writeError( const StringView& message )
+    {
+      CHROMATIC_STATS_SCOPE( Stats_Format );
+      switch ( format )
+      {
+        case OutputFormat_Text:
+          if ( errorStream && errorBuffer ) {
+            errorBuffer->append( message.data(), message.length() );
+            errorBuffer->push_back( '\n' );
+          } else if ( errorStream )
+            fputs( ( string( message.begin(), message.end() ) + '\n' ).c_str(), errorStream );
+          else {
+            put( message );
+            endRecord();
+          }
+        break;
+        case OutputFormat_Json:
+          put( "{\"type\":\"error\",\"message\":" );
+          putQuoted( message );
+          put( '}' );
+          endRecord();
+        break;
+        case OutputFormat_Csv:
+          putCsvRow( "error", "", "", "", "", message );
+        break;
+      }
+    }
+  };
+
+}
\ No newline at end of file
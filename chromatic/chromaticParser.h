@@ -0,0 +1,266 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <boost/utility/string_view.hpp>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticStats.h"
+
+namespace chromatic {
+
+  typedef boost::string_view StringView;
+
+  // Parse errors
+
+  enum ParseResult: int {
+    Parse_OK = 0,
+    Parse_Empty,
+    Parse_ExpectedNote,
+    Parse_UnknownChordSuffix,
+    Parse_UnknownScaleSuffix,
+    Parse_EmptyStep,
+    Parse_UnknownNumeral,
+    Parse_ExpectedOctave,
+    Parse_UnknownScaleMode,
+    Parse_NoTriadOnDegree,
+    Parse_ExpectedSteps,
+    Parse_UnknownStepQuality
+  };
+
+  const char* g_parseResultsStr[12] = {
+    "no error",
+    "empty input",
+    "expected a note name (A-G)",
+    "unknown chord type (expected m, a, o, sus4 or sus2)",
+    "unknown scale type (expected m or :<mode>)",
+    "empty progression step",
+    "unknown roman numeral (expected i to vii)",
+    "expected an octave number (0 to 9)",
+    "unknown scale mode",
+    "no triad on this degree of the scale",
+    "expected steps in semitones adding up to an octave, such as 2-2-1-2-2-2-1",
+    "unknown chord quality or figure (expected o, +, sus4, sus2, 6 or 64)"
+  };
+
+  struct ParseError {
+    ParseResult result;
+    size_t position;
+    ParseError(): result( Parse_OK ), position( 0 ) {}
+    bool fail( ParseResult _result, size_t _position )
+    {
+      result = _result;
+      position = _position;
+      return false;
+    }
+    const char* getString() const
+    {
+      return g_parseResultsStr[result];
+    }
+  };
+
+  // ASCII case-insensitive comparisons, for actions and options
+
+  inline bool equalsNoCase( const char* a, const char* b )
+  {
+    for ( ; *a && lowerAscii( *a ) == lowerAscii( *b ); a++, b++ );
+    return lowerAscii( *a ) == lowerAscii( *b );
+  }
+
+  inline bool startsWithNoCase( const char* str, const char* prefix )
+  {
+    for ( ; *prefix; str++, prefix++ )
+      if ( lowerAscii( *str ) != lowerAscii( *prefix ) )
+        return false;
+    return true;
+  }
+
+  // Semitone offset of each note letter from C, -1 for other letters
+
+  const int g_noteLetters[26] = {
+    9, 11, 0, 2, 4, 5, 7, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+  };
+
+  // Chord suffixes packed one lowercase character per byte, last character
+  // in the lowest byte, so a suffix is matched with a single integer compare.
+
+  const unsigned int g_chordSuffixKeys[6] = {
+    0,
+    'm',
+    'a',
+    'o',
+    ( 's' << 24 ) | ( 'u' << 16 ) | ( 's' << 8 ) | '4',
+    ( 's' << 24 ) | ( 'u' << 16 ) | ( 's' << 8 ) | '2'
+  };
+
+  inline bool packSuffix( const StringView& str, size_t pos, unsigned int& key )
+  {
+    if ( str.length() - pos > 4 )
+      return false;
+    key = 0;
+    for ( ; pos < str.length(); pos++ )
+    {
+      if ( (unsigned char)str[pos] > 0x7F )
+        return false;
+      key = ( key << 8 ) | lowerAscii( str[pos] );
+    }
+    return true;
+  }
+
+  // Consumes a note letter and an optional sharp or flat sign
+
+  inline bool parseNote( const StringView& str, size_t& pos, Note& note, ParseError& error )
+  {
+    if ( pos >= str.length() )
+      return error.fail( pos ? Parse_ExpectedNote : Parse_Empty, pos );
+    char c = lowerAscii( str[pos] );
+    if ( c < 'a' || c > 'z' || g_noteLetters[c - 'a'] < 0 )
+      return error.fail( Parse_ExpectedNote, pos );
+    int semitones = g_noteLetters[c - 'a'];
+    pos++;
+    if ( pos < str.length() ) {
+      if ( str[pos] == '#' ) {
+        semitones++;
+        pos++;
+      } else if ( lowerAscii( str[pos] ) == 'b' ) {
+        semitones--;
+        pos++;
+      }
+    }
+    note = (Note)( ( semitones + Interval_Octave ) % Interval_Octave );
+    return true;
+  }
+
+  bool parseNote( const StringView& str, Note& note, ParseError& error )
+  {
+    size_t pos = 0;
+    if ( !parseNote( str, pos, note, error ) )
+      return false;
+    if ( pos != str.length() )
+      return error.fail( Parse_ExpectedNote, pos );
+    return true;
+  }
+
+  // A note followed by its octave, such as C4 or Bb3. Cb and B# cross into
+  // the neighbouring octave.
+
+  bool parsePitch( const StringView& str, Pitch& pitch, ParseError& error )
+  {
+    size_t pos = 0;
+    Note note;
+    if ( !parseNote( str, pos, note, error ) )
+      return false;
+    if ( pos + 1 != str.length() || str[pos] < '0' || str[pos] > '9' )
+      return error.fail( Parse_ExpectedOctave, pos );
+    int octave = str[pos] - '0';
+    char letter = lowerAscii( str[0] );
+    if ( letter == 'c' && note == Note_B )
+      octave--;
+    else if ( letter == 'b' && note == Note_C )
+      octave++;
+    int value = ( octave + 1 ) * Interval_Octave + note;
+    if ( value < 0 || value > Pitch_Highest )
+      return error.fail( Parse_ExpectedOctave, pos );
+    pitch = (Pitch)value;
+    return true;
+  }
+
+  bool parseChord( const StringView& str, Triad& chord, ParseError& error )
+  {
+    CHROMATIC_STATS_SCOPE( Stats_ParseChord );
+    size_t pos = 0;
+    Note root;
+    if ( !parseNote( str, pos, root, error ) )
+      return false;
+    unsigned int key;
+    if ( packSuffix( str, pos, key ) )
+    {
+      for ( int type = ChordType_Major; type <= ChordType_SuspendedSecond; type++ )
+      {
+        if ( key == g_chordSuffixKeys[type] ) {
+          chord = Triad( root, (ChordType)type );
+          return true;
+        }
+      }
+    }
+    return error.fail( Parse_UnknownChordSuffix, pos );
+  }
+
+  bool parseScale( const StringView& str, Scale& scale, ParseError& error )
+  {
+    CHROMATIC_STATS_SCOPE( Stats_ParseScale );
+    size_t pos = 0;
+    Note root;
+    if ( !parseNote( str, pos, root, error ) )
+      return false;
+    if ( pos == str.length() )
+      scale = Scale( root, ScaleMode_Major );
+    else if ( pos + 1 == str.length() && lowerAscii( str[pos] ) == 'm' )
+      scale = Scale( root, ScaleMode_Minor );
+    else if ( str[pos] == ':' ) {
+      int mode = g_scales.find( str.substr( pos + 1 ) );
+      if ( mode < 0 )
+        return error.fail( Parse_UnknownScaleMode, pos + 1 );
+      scale = Scale( root, (ScaleMode)mode );
+    }
+    else
+      return error.fail( Parse_UnknownScaleSuffix, pos );
+    return true;
+  }
+
+  // A scale mode definition of the form "<key> <steps> <name>", such as
+  // "hungarian-minor 2-1-3-1-1-3-1 Hungarian Minor". Steps are the
+  // semitones between neighbouring notes and must add up to an octave.
+
+  bool parseScaleModeDef( const StringView& str, string& key, string& name, unsigned short& pattern, ParseError& error )
+  {
+    size_t keyEnd = str.find( ' ' );
+    if ( str.empty() )
+      return error.fail( Parse_Empty, 0 );
+    if ( !keyEnd || keyEnd == StringView::npos )
+      return error.fail( Parse_ExpectedSteps, keyEnd == StringView::npos ? str.length() : 0 );
+    size_t pos = str.find_first_not_of( ' ', keyEnd );
+    size_t stepsEnd = pos == StringView::npos ? StringView::npos : str.find( ' ', pos );
+    if ( pos == StringView::npos || stepsEnd == StringView::npos )
+      return error.fail( Parse_ExpectedSteps, pos == StringView::npos ? str.length() : pos );
+    size_t nameStart = str.find_first_not_of( ' ', stepsEnd );
+    if ( nameStart == StringView::npos )
+      return error.fail( Parse_Empty, str.length() );
+    int semitone = 0;
+    pattern = 1;
+    while ( pos < stepsEnd )
+    {
+      if ( str[pos] < '1' || str[pos] > '9' )
+        return error.fail( Parse_ExpectedSteps, pos );
+      semitone += str[pos++] - '0';
+      if ( semitone > Interval_Octave || ( pos < stepsEnd && str[pos++] != '-' ) )
+        return error.fail( Parse_ExpectedSteps, pos - 1 );
+      if ( semitone < Interval_Octave )
+        pattern |= (unsigned short)( 1 << semitone );
+    }
+    if ( semitone != Interval_Octave )
+      return error.fail( Parse_ExpectedSteps, stepsEnd );
+    key.assign( str.begin(), str.begin() + keyEnd );
+    name.assign( str.begin() + nameStart, str.end() );
+    return true;
+  }
+
+}
\ No newline at end of file
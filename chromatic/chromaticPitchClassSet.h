@@ -0,0 +1,154 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstring>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+
+namespace chromatic {
+
+  // Pitch class set, one bit per note from C (bit 0) to B (bit 11)
+
+  struct PitchClassSet {
+  public:
+    unsigned short mask;
+    PitchClassSet(): mask( 0 ) {}
+    explicit PitchClassSet( unsigned int _mask ): mask( (unsigned short)( _mask & 0xFFF ) ) {}
+    PitchClassSet( const Triad& triad ):
+    mask( (unsigned short)( ( 1 << triad.first ) | ( 1 << triad.second ) | ( 1 << triad.third ) ) ) {}
+    void add( Note note )
+    {
+      mask |= ( 1 << note );
+    }
+    bool contains( Note note ) const
+    {
+      return ( mask & ( 1 << note ) ) != 0;
+    }
+    bool empty() const
+    {
+      return mask == 0;
+    }
+    int count() const
+    {
+      unsigned int x = mask;
+      x = x - ( ( x >> 1 ) & 0x555 );
+      x = ( x & 0x333 ) + ( ( x >> 2 ) & 0x333 );
+      x = ( x + ( x >> 4 ) ) & 0xF0F;
+      return (int)( ( x + ( x >> 8 ) ) & 0x1F );
+    }
+    PitchClassSet transpose( Semitones interval ) const
+    {
+      int i = interval % Interval_Octave;
+      if ( i < 0 )
+        i += Interval_Octave;
+      return PitchClassSet( ( (unsigned int)mask << i ) | ( (unsigned int)mask >> ( Interval_Octave - i ) ) );
+    }
+    bool isSubsetOf( const PitchClassSet& other ) const
+    {
+      return ( mask & ~other.mask ) == 0;
+    }
+    PitchClassSet intersect( const PitchClassSet& other ) const
+    {
+      return PitchClassSet( mask & other.mask );
+    }
+    PitchClassSet unite( const PitchClassSet& other ) const
+    {
+      return PitchClassSet( mask | other.mask );
+    }
+    bool operator == ( const PitchClassSet& other ) const
+    {
+      return mask == other.mask;
+    }
+    bool operator != ( const PitchClassSet& other ) const
+    {
+      return mask != other.mask;
+    }
+  };
+
+  // Chord identification
+
+  enum Inversion: int {
+    Inversion_Root = 0,
+    Inversion_First,
+    Inversion_Second
+  };
+
+  const char* g_inversionsStr[3] = {
+    "root position", "first inversion", "second inversion"
+  };
+
+  // Every triad whose notes form a given pitch class set. Augmented triads
+  // are symmetric and suspended triads overlap (Csus4 = Fsus2), so a set may
+  // name up to three triads. Each triad is stored as root * 6 + type.
+
+  struct ChordIdentity {
+    unsigned char count;
+    unsigned char triads[3];
+  };
+
+  class ChordIdentityTable {
+  protected:
+    ChordIdentity entries[4096];
+  public:
+    ChordIdentityTable()
+    {
+      memset( entries, 0, sizeof( entries ) );
+      for ( int root = Note_C; root <= Note_B; root++ )
+        for ( int type = ChordType_Major; type <= ChordType_SuspendedSecond; type++ )
+        {
+          ChordIdentity& entry = entries[PitchClassSet( Triad( (Note)root, (ChordType)type ) ).mask];
+          entry.triads[entry.count++] = (unsigned char)( root * 6 + type );
+        }
+    }
+    const ChordIdentity& operator[]( const PitchClassSet& set ) const
+    {
+      return entries[set.mask];
+    }
+  };
+
+  const ChordIdentityTable g_chordIdentities;
+
+  // Names the triad formed by a set of notes. The bass note decides both
+  // the inversion and which reading of an ambiguous set is preferred.
+
+  bool identifyChord( const PitchClassSet& set, Note bass, Triad& chord, Inversion& inversion )
+  {
+    const ChordIdentity& entry = g_chordIdentities[set];
+    if ( !entry.count )
+      return false;
+    int match = 0;
+    for ( int i = 0; i < entry.count; i++ )
+    {
+      if ( entry.triads[i] / 6 == bass ) {
+        match = i;
+        break;
+      }
+    }
+    chord = Triad( (Note)( entry.triads[match] / 6 ), (ChordType)( entry.triads[match] % 6 ) );
+    if ( bass == chord.second )
+      inversion = Inversion_First;
+    else if ( bass == chord.third )
+      inversion = Inversion_Second;
+    else
+      inversion = Inversion_Root;
+    return true;
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,523 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticFiles.h"
+
+namespace chromatic {
+
+  using std::string;
+  using std::vector;
+
+  // Binary progression files. A progression is a key byte, with the root in
+  // the low four bits and the mode in the high four, followed by one byte
+  // per step:
+  //   bits 0-2  degree, or 7 for an extended step
+  //   bits 3-5  chord type, or the quality of an extended step
+  //   bit 6     applied, for extended steps
+  //   bit 7     set on the last step
+  // Extended steps (borrowed, applied, qualified or inverted) carry another
+  // byte with their numeral and inversion, and applied steps one more with
+  // the numeral of their target.
+  //
+  // Progressions are packed into blocks that they never straddle, followed
+  // by an index of the blocks, so that a file can be read from any block
+  // and in parallel. Modes are numbered per file, and stored by key and
+  // pattern in the header so that files survive changes to --scales.
+
+  const char g_progressionFileMagic[4] = { 'C', 'H', 'R', 'P' };
+
+  const unsigned int g_progressionFileVersion = 1;
+
+  const size_t g_progressionBlockSize = 1 << 16;
+
+  const int g_progressionFileModes = 16;
+
+  // At most three bytes per step, plus the key byte, within a block
+  const size_t g_progressionMaxSteps = ( g_progressionBlockSize - 1 ) / 3;
+
+  const unsigned char g_stepExtended = 0x07;
+  const unsigned char g_stepApplied = 0x40;
+  const unsigned char g_stepLast = 0x80;
+
+  struct ProgressionFileMode {
+    char key[30];
+    unsigned short pattern;
+  };
+
+  struct ProgressionFileHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int blockSize;
+    unsigned int modeCount;
+    unsigned long long progressions;
+    unsigned long long steps;
+    unsigned long long blocks;
+    unsigned long long indexOffset;
+    ProgressionFileMode modes[g_progressionFileModes];
+  };
+
+  // Index entry of a block, which starts blockSize bytes after the one
+  // before it, the first right after the header
+  struct ProgressionBlockInfo {
+    unsigned long long first;
+    unsigned int size;
+    unsigned int count;
+  };
+
+  enum ProgressionFileResult: int {
+    ProgressionFile_OK = 0,
+    ProgressionFile_CannotOpen,
+    ProgressionFile_NotProgressions,
+    ProgressionFile_Corrupt,
+    ProgressionFile_UnknownMode
+  };
+
+  const char* g_progressionFileResultsStr[5] = {
+    "no error",
+    "could not be opened",
+    "not a progression file",
+    "truncated or corrupt",
+    "uses a scale mode that is not loaded"
+  };
+
+  inline unsigned char encodeNumeral( const StepNumeral& numeral )
+  {
+    unsigned char accidental = numeral.accidental < 0 ? 1 : numeral.accidental > 0 ? 2 : 0;
+    return (unsigned char)( numeral.degree | ( accidental << 3 ) | ( numeral.upper ? 0x20 : 0 ) );
+  }
+
+  inline void decodeNumeral( unsigned char c, StepNumeral& numeral )
+  {
+    numeral.degree = (Degree)( c & 7 );
+    numeral.accidental = ( c & 0x18 ) == 0x08 ? Accidental_Flat : ( c & 0x18 ) == 0x10 ? Accidental_Sharp : Accidental_None;
+    numeral.upper = ( c & 0x20 ) != 0;
+  }
+
+  // Appends a progression with its mode numbered as given; fails if it is
+  // empty or too long for a block
+
+  inline bool encodeProgression( const ChordProgression& progression, int mode, vector<unsigned char>& output )
+  {
+    const ProgressionVector& steps = progression.getSteps();
+    if ( steps.empty() || steps.size() > g_progressionMaxSteps )
+      return false;
+    output.push_back( (unsigned char)( progression.getScale().getRoot() | ( mode << 4 ) ) );
+    for ( size_t i = 0; i < steps.size(); i++ )
+    {
+      const ChordProgressionStep& step = steps[i];
+      unsigned char last = i + 1 == steps.size() ? g_stepLast : 0;
+      if ( step.isPlain() ) {
+        output.push_back( (unsigned char)( step.degree | ( step.chord.type << 3 ) | last ) );
+        continue;
+      }
+      output.push_back( (unsigned char)( g_stepExtended | ( step.quality << 3 ) | ( step.applied ? g_stepApplied : 0 ) | last ) );
+      output.push_back( (unsigned char)( encodeNumeral( step.numeral ) | ( step.inversion << 6 ) ) );
+      if ( step.applied )
+        output.push_back( encodeNumeral( step.target ) );
+    }
+    return true;
+  }
+
+  // Decodes the step at pos in a scale and moves past it. The bytes must
+  // be in range, as a ProgressionCursor checks them; fails if the numerals
+  // do not resolve to a chord in the scale.
+
+  inline bool decodeStep( const Scale& scale, const unsigned char*& pos, ChordProgressionStep& step )
+  {
+    unsigned char c = *pos++;
+    Degree degree = (Degree)( c & 7 );
+    if ( degree != g_stepExtended ) {
+      step = ChordProgressionStep( degree, Triad( scale.getNotes()[degree], (ChordType)( ( c >> 3 ) & 7 ) ) );
+      return true;
+    }
+    step = ChordProgressionStep( Degree_Tonic, Triad() );
+    step.quality = (StepQuality)( ( c >> 3 ) & 7 );
+    step.applied = ( c & g_stepApplied ) != 0;
+    decodeNumeral( *pos, step.numeral );
+    step.inversion = (Inversion)( *pos++ >> 6 );
+    if ( step.applied )
+      decodeNumeral( *pos++, step.target );
+    ParseResult result;
+    return resolveStep( scale, step, result );
+  }
+
+  // Bytes in the steps of a progression that ends within the eight bytes
+  // at pos when all of them are plain steps of a scale with the given
+  // number of degrees, or zero when the cursor has to look at them one by
+  // one. Most progressions are short and plain, so this lets the cursor
+  // check and pass over them in a single step.
+
+  inline size_t plainStepsLength( const unsigned char* pos, int degrees )
+  {
+    const unsigned long long ones = 0x0101010101010101ULL;
+    const unsigned long long high = 0x8080808080808080ULL;
+    unsigned long long x = 0;
+    for ( int i = 0; i < 8; i++ )
+      x |= (unsigned long long)pos[i] << ( i * 8 );
+    unsigned long long last = x & high;
+    if ( !last )
+      return 0;
+    // Bit 3 of each byte set where the degree is extended or out of range,
+    // the chord type is unknown or the applied bit is set
+    unsigned long long bad = ( ( x & ones * 7 ) + ones * ( 8 - degrees ) )
+      | ( ( ( x >> 3 ) & ones * 7 ) + ones * 2 ) | ( x >> 3 );
+    // Every bit up to the end of the first last step
+    unsigned long long steps = last ^ ( last - 1 );
+    if ( bad & steps & ones * 8 )
+      return 0;
+    return (size_t)( ( ( ( steps & high ) >> 7 ) * ones ) >> 56 );
+  }
+
+  // A stored progression, pointing into the file
+  struct PackedProgression {
+    Scale scale;
+    const unsigned char* steps;
+    size_t size;
+  };
+
+  // Walks the progressions of one block without copying them. Every step
+  // is checked to be in range as it is passed over, and extended steps to
+  // resolve in the scale, so a corrupt file ends the walk early instead of
+  // being read out of bounds or decoded into chords it does not hold.
+
+  class ProgressionCursor {
+  protected:
+    const unsigned char* pos;
+    const unsigned char* end;
+    const ScaleMode* modes;
+    int modeCount;
+    bool corrupt;
+    ChordProgressionStep step;
+  public:
+    ProgressionCursor( const unsigned char* _pos, const unsigned char* _end, const ScaleMode* _modes, int _modeCount ):
+    pos( _pos ), end( _end ), modes( _modes ), modeCount( _modeCount ), corrupt( false ),
+    step( Degree_Tonic, Triad() )
+    {
+    }
+    bool next( PackedProgression& progression )
+    {
+      if ( pos >= end )
+        return false;
+      unsigned char key = *pos++;
+      if ( ( key & 0xF ) > Note_B || ( key >> 4 ) >= modeCount ) {
+        corrupt = true;
+        return false;
+      }
+      progression.scale = Scale( (Note)( key & 0xF ), modes[key >> 4] );
+      progression.steps = pos;
+      int degrees = progression.scale.getDegreeCount();
+      if ( end - pos >= 8 ) {
+        size_t length = plainStepsLength( pos, degrees );
+        if ( length ) {
+          pos += length;
+          progression.size = length;
+          return true;
+        }
+      }
+      for ( unsigned char c = 0; !( c & g_stepLast ); )
+      {
+        if ( pos >= end ) {
+          corrupt = true;
+          return false;
+        }
+        c = *pos++;
+        if ( ( c & 7 ) != g_stepExtended ) {
+          if ( ( c & 7 ) >= degrees || ( ( c >> 3 ) & 7 ) > ChordType_SuspendedSecond || ( c & g_stepApplied ) ) {
+            corrupt = true;
+            return false;
+          }
+          continue;
+        }
+        size_t extra = ( c & g_stepApplied ) ? 2 : 1;
+        if ( ( ( c >> 3 ) & 7 ) > StepQuality_SuspendedSecond || (size_t)( end - pos ) < extra
+          || ( pos[0] & 7 ) == 7 || ( pos[0] >> 6 ) > Inversion_Second || ( extra == 2 && ( pos[1] & 7 ) == 7 ) ) {
+          corrupt = true;
+          return false;
+        }
+        const unsigned char* stepPos = pos - 1;
+        if ( !decodeStep( progression.scale, stepPos, step ) ) {
+          corrupt = true;
+          return false;
+        }
+        pos += extra;
+      }
+      progression.size = pos - progression.steps;
+      return true;
+    }
+    bool isCorrupt() const
+    {
+      return corrupt;
+    }
+    const unsigned char* getEnd() const
+    {
+      return end;
+    }
+  };
+
+  class ProgressionFileReader {
+  protected:
+    MappedFile file;
+    ProgressionFileHeader header;
+    vector<ProgressionBlockInfo> blocks;
+    ScaleMode modes[g_progressionFileModes];
+  public:
+    ProgressionFileResult open( const string& path )
+    {
+      blocks.clear();
+      if ( !file.open( path ) )
+        return ProgressionFile_CannotOpen;
+      if ( file.getSize() < sizeof( header ) )
+        return ProgressionFile_NotProgressions;
+      memcpy( &header, file.getData(), sizeof( header ) );
+      if ( memcmp( header.magic, g_progressionFileMagic, 4 ) || header.version != g_progressionFileVersion )
+        return ProgressionFile_NotProgressions;
+      if ( header.blockSize != g_progressionBlockSize || header.modeCount > (unsigned int)g_progressionFileModes
+        || header.indexOffset > file.getSize() || ( file.getSize() - header.indexOffset ) / sizeof( ProgressionBlockInfo ) < header.blocks
+        || ( header.blocks && header.indexOffset < sizeof( header ) + ( header.blocks - 1 ) * g_progressionBlockSize ) )
+        return ProgressionFile_Corrupt;
+      blocks.resize( (size_t)header.blocks );
+      if ( header.blocks )
+        memcpy( &blocks[0], file.getData() + header.indexOffset, blocks.size() * sizeof( ProgressionBlockInfo ) );
+      unsigned long long first = 0;
+      for ( size_t i = 0; i < blocks.size(); i++ )
+      {
+        if ( blocks[i].size > g_progressionBlockSize || blocks[i].first != first
+          || sizeof( header ) + i * g_progressionBlockSize + blocks[i].size > header.indexOffset )
+          return ProgressionFile_Corrupt;
+        first += blocks[i].count;
+      }
+      if ( first != header.progressions )
+        return ProgressionFile_Corrupt;
+      for ( unsigned int i = 0; i < header.modeCount; i++ )
+      {
+        const ProgressionFileMode& stored = header.modes[i];
+        int mode = g_scales.find( string( stored.key, strnlen( stored.key, sizeof( stored.key ) ) ) );
+        if ( mode < 0 || g_scales.getMode( (ScaleMode)mode ).pattern != stored.pattern )
+          return ProgressionFile_UnknownMode;
+        modes[i] = (ScaleMode)mode;
+      }
+      return ProgressionFile_OK;
+    }
+    unsigned long long getProgressions() const
+    {
+      return header.progressions;
+    }
+    unsigned long long getSteps() const
+    {
+      return header.steps;
+    }
+    size_t getBlockCount() const
+    {
+      return blocks.size();
+    }
+    const ProgressionBlockInfo& getBlockInfo( size_t block ) const
+    {
+      return blocks[block];
+    }
+    ProgressionCursor getBlock( size_t block ) const
+    {
+      const unsigned char* start = file.getData() + sizeof( header ) + block * g_progressionBlockSize;
+      return ProgressionCursor( start, start + blocks[block].size, modes, (int)header.modeCount );
+    }
+    // Position of a progression in the file, for finding it again later
+    unsigned long long getOffset( const PackedProgression& progression ) const
+    {
+      return (unsigned long long)( progression.steps - 1 - file.getData() );
+    }
+    // Reads the progression that comes skip places after the one at offset,
+    // moving on to the blocks after it as needed
+    bool find( unsigned long long offset, unsigned long long skip, PackedProgression& progression ) const
+    {
+      if ( offset < sizeof( header ) )
+        return false;
+      size_t block = (size_t)( ( offset - sizeof( header ) ) / g_progressionBlockSize );
+      if ( block >= blocks.size() || offset - sizeof( header ) - block * g_progressionBlockSize >= blocks[block].size )
+        return false;
+      ProgressionCursor cursor = getBlock( block );
+      cursor = ProgressionCursor( file.getData() + offset, cursor.getEnd(), modes, (int)header.modeCount );
+      for ( ;; )
+      {
+        if ( !cursor.next( progression ) ) {
+          if ( cursor.isCorrupt() || ++block >= blocks.size() )
+            return false;
+          cursor = getBlock( block );
+          continue;
+        }
+        if ( !skip-- )
+          return true;
+      }
+    }
+  };
+
+  // Writes a progression file front to back; the header is written again
+  // with the totals when the file is closed.
+
+  class ProgressionFileWriter {
+  protected:
+    FILE* file;
+    ProgressionFileHeader header;
+    vector<unsigned char> block;
+    vector<ProgressionBlockInfo> blocks;
+    ScaleMode modes[g_progressionFileModes];
+    bool failed;
+    unsigned long long offset;
+    // File number of a mode, adding it to the header if it is new; -1 if
+    // the header is full or the key does not fit
+    int findMode( ScaleMode mode )
+    {
+      for ( unsigned int i = 0; i < header.modeCount; i++ )
+        if ( modes[i] == mode )
+          return (int)i;
+      const ScaleModeInfo& info = g_scales.getMode( mode );
+      if ( header.modeCount == (unsigned int)g_progressionFileModes || info.key.length() > sizeof( header.modes[0].key ) )
+        return -1;
+      ProgressionFileMode& stored = header.modes[header.modeCount];
+      memset( stored.key, 0, sizeof( stored.key ) );
+      memcpy( stored.key, info.key.data(), info.key.length() );
+      stored.pattern = info.pattern;
+      modes[header.modeCount] = mode;
+      return (int)header.modeCount++;
+    }
+    void writeBlock( bool pad )
+    {
+      ProgressionBlockInfo& info = blocks.back();
+      info.size = (unsigned int)block.size();
+      if ( pad )
+        block.resize( g_progressionBlockSize, 0 );
+      if ( !block.empty() && fwrite( &block[0], 1, block.size(), file ) != block.size() )
+        failed = true;
+      offset += block.size();
+      block.clear();
+    }
+    ProgressionFileWriter( const ProgressionFileWriter& );
+    ProgressionFileWriter& operator=( const ProgressionFileWriter& );
+  public:
+    ProgressionFileWriter(): file( NULL ), failed( false ), offset( 0 )
+    {
+    }
+    ~ProgressionFileWriter()
+    {
+      if ( file )
+        fclose( file );
+    }
+    bool open( const string& path )
+    {
+      file = openFile( path, "wb" );
+      if ( !file )
+        return false;
+      memset( &header, 0, sizeof( header ) );
+      memcpy( header.magic, g_progressionFileMagic, 4 );
+      header.version = g_progressionFileVersion;
+      header.blockSize = (unsigned int)g_progressionBlockSize;
+      block.reserve( g_progressionBlockSize );
+      failed = fwrite( &header, sizeof( header ), 1, file ) != 1;
+      offset = sizeof( header );
+      return !failed;
+    }
+    // Adds a progression; fails if it is empty or too long, or if the file
+    // already has as many modes as it can hold
+    bool add( const ChordProgression& progression )
+    {
+      int mode = findMode( progression.getScale().getMode() );
+      size_t start = block.size();
+      if ( mode < 0 || !encodeProgression( progression, mode, block ) )
+        return false;
+      if ( blocks.empty() || block.size() > g_progressionBlockSize ) {
+        vector<unsigned char> moved( block.begin() + start, block.end() );
+        block.resize( start );
+        if ( !blocks.empty() )
+          writeBlock( true );
+        ProgressionBlockInfo info = { header.progressions, 0, 0 };
+        blocks.push_back( info );
+        block.insert( block.end(), moved.begin(), moved.end() );
+      }
+      blocks.back().count++;
+      header.progressions++;
+      header.steps += progression.getSteps().size();
+      return true;
+    }
+    // Writes the index and the final header; false if anything could not
+    // be written
+    bool close()
+    {
+      if ( !file )
+        return false;
+      if ( !blocks.empty() )
+        writeBlock( false );
+      header.blocks = blocks.size();
+      header.indexOffset = offset;
+      if ( !blocks.empty() && fwrite( &blocks[0], sizeof( ProgressionBlockInfo ), blocks.size(), file ) != blocks.size() )
+        failed = true;
+      if ( fseek( file, 0, SEEK_SET ) != 0 || fwrite( &header, sizeof( header ), 1, file ) != 1 )
+        failed = true;
+      failed = fclose( file ) != 0 || failed;
+      file = NULL;
+      return !failed;
+    }
+  };
+
+  // Writes a scale back in the shorthand it is parsed from, such as F#m or
+  // D:dorian
+  inline void appendScaleShorthand( const Scale& scale, string& str )
+  {
+    str.append( g_notesSharpStr[scale.getRoot()] );
+    if ( scale.getMode() == ScaleMode_Minor )
+      str.push_back( 'm' );
+    else if ( scale.getMode() != ScaleMode_Major ) {
+      str.push_back( ':' );
+      str.append( g_scales.getMode( scale.getMode() ).key );
+    }
+  }
+
+  // Writes the numerals of a stored progression, in the form "i-VI-iv-v".
+  // The progression comes from a ProgressionCursor, so all of its steps
+  // decode.
+  inline void appendPackedSteps( const PackedProgression& progression, string& str )
+  {
+    const unsigned char* pos = progression.steps;
+    const unsigned char* end = pos + progression.size;
+    ChordProgressionStep step( Degree_Tonic, Triad() );
+    while ( pos < end )
+    {
+      if ( pos != progression.steps )
+        str.push_back( '-' );
+      decodeStep( progression.scale, pos, step );
+      appendStep( progression.scale, step, str );
+    }
+  }
+
+  // Writes a stored progression as text, in the form "i-VI-iv-v F#m"
+  inline void appendPackedProgression( const PackedProgression& progression, string& str )
+  {
+    appendPackedSteps( progression, str );
+    str.push_back( ' ' );
+    appendScaleShorthand( progression.scale, str );
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,531 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticChordProgression.h"
+#include "chromaticFiles.h"
+#include "chromaticThreadPool.h"
+#include "chromaticProgressionFile.h"
+
+namespace chromatic {
+
+  using std::string;
+  using std::vector;
+
+  // Inverted index of a binary progression file. Every run of two or three
+  // chords in a progression is reduced to a term: the type of its first
+  // chord and, for each chord after that, the interval its root moves by
+  // and its type. A run has the same term in every key and mode, so ii-V-I
+  // in C major finds Dm-G-C as well as Am-D-G or vi-II-V in a minor key.
+  //
+  // Each term has a posting list of the numbers of the progressions that
+  // contain it, ascending, stored as variable-length deltas. Every 128th
+  // posting is kept in full in a skip table, so lists are intersected by
+  // jumping over the blocks that cannot match. The index also stores the
+  // file offset of every 64th progression to find matches in the file.
+
+  const char g_progressionIndexMagic[4] = { 'C', 'H', 'R', 'I' };
+
+  const unsigned int g_progressionIndexVersion = 1;
+
+  const unsigned int g_indexSkipInterval = 128;
+
+  const unsigned int g_indexLocatorInterval = 64;
+
+  // Terms are numbered bigrams first, then trigrams
+  const unsigned int g_indexChordTypes = ChordType_SuspendedSecond + 1;
+  const unsigned int g_indexMoves = Interval_Octave * g_indexChordTypes;
+  const unsigned int g_indexBigrams = g_indexChordTypes * g_indexMoves;
+  const unsigned int g_indexTerms = g_indexBigrams + g_indexBigrams * g_indexMoves;
+
+  struct ProgressionIndexHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned int terms;
+    unsigned int skipInterval;
+    unsigned int locatorInterval;
+    unsigned int reserved;
+    // Totals of the progression file, to tell when the index is out of date
+    unsigned long long progressions;
+    unsigned long long steps;
+    unsigned long long postings;
+    unsigned long long locatorOffset;
+  };
+
+  // Directory entry of a term. Its data is the skip table, one entry for
+  // every skipInterval postings, followed by the deltas.
+  struct ProgressionIndexTerm {
+    unsigned long long offset;
+    unsigned int count;
+    unsigned int size;
+  };
+
+  // A posting kept in full, and where the deltas after it start
+  struct ProgressionIndexSkip {
+    unsigned int first;
+    unsigned int offset;
+  };
+
+  enum ProgressionIndexResult: int {
+    ProgressionIndex_OK = 0,
+    ProgressionIndex_CannotOpen,
+    ProgressionIndex_NotIndex,
+    ProgressionIndex_Corrupt,
+    ProgressionIndex_OutOfDate
+  };
+
+  const char* g_progressionIndexResultsStr[5] = {
+    "no error",
+    "could not be opened",
+    "not a progression index",
+    "truncated or corrupt",
+    "out of date, index the progressions again"
+  };
+
+  inline unsigned int indexMove( const Triad& from, const Triad& to )
+  {
+    return ( ( to.first - from.first + Interval_Octave ) % Interval_Octave ) * g_indexChordTypes + to.type;
+  }
+
+  inline unsigned int indexBigram( const Triad* chords )
+  {
+    return chords[0].type * g_indexMoves + indexMove( chords[0], chords[1] );
+  }
+
+  inline unsigned int indexTrigram( const Triad* chords )
+  {
+    return g_indexBigrams + indexBigram( chords ) * g_indexMoves + indexMove( chords[1], chords[2] );
+  }
+
+  // Whether the chords contain the run of the query anywhere, in any key
+  inline bool containsRun( const vector<Triad>& chords, const vector<Triad>& query )
+  {
+    for ( size_t i = 0; i + query.size() <= chords.size(); i++ )
+    {
+      size_t j = 0;
+      while ( j < query.size() && chords[i + j].type == query[j].type
+        && ( !j || indexMove( chords[i + j - 1], chords[i + j] ) == indexMove( query[j - 1], query[j] ) ) )
+        j++;
+      if ( j == query.size() )
+        return true;
+    }
+    return false;
+  }
+
+  inline void decodeChords( const PackedProgression& progression, ChordProgressionStep& step, vector<Triad>& chords )
+  {
+    chords.clear();
+    for ( const unsigned char* pos = progression.steps, *end = pos + progression.size; pos < end; )
+    {
+      decodeStep( progression.scale, pos, step );
+      chords.push_back( step.chord );
+    }
+  }
+
+  inline void appendVarint( unsigned int value, vector<unsigned char>& output )
+  {
+    for ( ; value >= 0x80; value >>= 7 )
+      output.push_back( (unsigned char)( value | 0x80 ) );
+    output.push_back( (unsigned char)value );
+  }
+
+  // Walks the posting list of a term. Every read is checked against the
+  // end of the term's data, so a corrupt index ends the walk early.
+
+  class PostingCursor {
+  protected:
+    const ProgressionIndexSkip* skips;
+    const unsigned char* data;
+    unsigned int size;
+    unsigned int count;
+    size_t skipCount;
+    size_t block;
+    const unsigned char* pos;
+    unsigned int left;
+    unsigned int current;
+    bool started;
+    bool corrupt;
+    bool enter( size_t next )
+    {
+      if ( skips[next].offset > size ) {
+        corrupt = true;
+        return false;
+      }
+      block = next;
+      pos = data + skips[next].offset;
+      left = std::min( g_indexSkipInterval, count - (unsigned int)( next * g_indexSkipInterval ) ) - 1;
+      current = skips[next].first;
+      started = true;
+      return true;
+    }
+  public:
+    PostingCursor( const unsigned char* _data, unsigned int _size, unsigned int _count ):
+    skips( (const ProgressionIndexSkip*)_data ), size( _size ), count( _count ), block( 0 ), pos( NULL ),
+    left( 0 ), current( 0 ), started( false ), corrupt( false )
+    {
+      skipCount = ( count + g_indexSkipInterval - 1 ) / g_indexSkipInterval;
+      data = _data + skipCount * sizeof( ProgressionIndexSkip );
+      size -= (unsigned int)( skipCount * sizeof( ProgressionIndexSkip ) );
+    }
+    unsigned int getCount() const
+    {
+      return count;
+    }
+    unsigned int get() const
+    {
+      return current;
+    }
+    bool isCorrupt() const
+    {
+      return corrupt;
+    }
+    // Moves to the next posting; false at the end of the list
+    bool next()
+    {
+      if ( !started )
+        return skipCount && enter( 0 );
+      if ( !left )
+        return block + 1 < skipCount && enter( block + 1 );
+      unsigned int delta = 0;
+      for ( int shift = 0;; shift += 7 )
+      {
+        if ( pos >= data + size || shift > 28 ) {
+          corrupt = true;
+          return false;
+        }
+        unsigned char c = *pos++;
+        delta |= (unsigned int)( c & 0x7F ) << shift;
+        if ( !( c & 0x80 ) )
+          break;
+      }
+      current += delta;
+      left--;
+      return true;
+    }
+    // Moves to the first posting at or after target; false if there is none
+    bool seek( unsigned int target )
+    {
+      if ( started && current >= target )
+        return true;
+      // Last block starting at or before the target
+      size_t low = started ? block : 0;
+      const ProgressionIndexSkip* found = std::upper_bound( skips + low, skips + skipCount, target,
+        []( unsigned int value, const ProgressionIndexSkip& skip ) { return value < skip.first; } );
+      size_t jump = found == skips + low ? low : (size_t)( found - skips ) - 1;
+      if ( ( !started || jump != block ) && ( !skipCount || !enter( jump ) ) )
+        return false;
+      while ( current < target )
+        if ( !next() )
+          return false;
+      return true;
+    }
+  };
+
+  // Builds the index of a progression file. The blocks are split between
+  // the threads, each collecting the posting lists of its share; the lists
+  // are then joined and compressed a range of terms at a time.
+
+  class ProgressionIndexBuilder {
+  protected:
+    typedef vector<unsigned int> Postings;
+    const ProgressionFileReader& file;
+    vector<vector<Postings> > chunks;
+    vector<vector<unsigned char> > ranges;
+    vector<ProgressionIndexTerm> terms;
+    vector<unsigned long long> locator;
+    std::atomic<bool> corrupt;
+    unsigned long long postings;
+    static void add( Postings& list, unsigned int id )
+    {
+      if ( list.empty() || list.back() != id )
+        list.push_back( id );
+    }
+    void collect( vector<Postings>& lists, size_t firstBlock, size_t lastBlock )
+    {
+      ChordProgressionStep step( Degree_Tonic, Triad() );
+      vector<Triad> chords;
+      PackedProgression progression;
+      for ( size_t block = firstBlock; block < lastBlock; block++ )
+      {
+        ProgressionCursor cursor = file.getBlock( block );
+        unsigned int id = (unsigned int)file.getBlockInfo( block ).first;
+        for ( ; cursor.next( progression ); id++ )
+        {
+          if ( id >= file.getProgressions() ) {
+            corrupt = true;
+            return;
+          }
+          if ( id % g_indexLocatorInterval == 0 )
+            locator[id / g_indexLocatorInterval] = file.getOffset( progression );
+          decodeChords( progression, step, chords );
+          for ( size_t i = 0; i + 1 < chords.size(); i++ )
+          {
+            add( lists[indexBigram( &chords[i] )], id );
+            if ( i + 2 < chords.size() )
+              add( lists[indexTrigram( &chords[i] )], id );
+          }
+        }
+        const ProgressionBlockInfo& info = file.getBlockInfo( block );
+        if ( cursor.isCorrupt() || id != info.first + info.count )
+          corrupt = true;
+      }
+    }
+    void encode( vector<unsigned char>& data, unsigned int firstTerm, unsigned int lastTerm )
+    {
+      for ( unsigned int t = firstTerm; t < lastTerm; t++ )
+      {
+        ProgressionIndexTerm& term = terms[t];
+        term.offset = data.size();
+        term.count = 0;
+        for ( size_t c = 0; c < chunks.size(); c++ )
+          term.count += (unsigned int)chunks[c][t].size();
+        size_t skipStart = data.size();
+        size_t skipCount = ( term.count + g_indexSkipInterval - 1 ) / g_indexSkipInterval;
+        data.resize( skipStart + skipCount * sizeof( ProgressionIndexSkip ) );
+        size_t deltaStart = data.size();
+        unsigned int posting = 0, previous = 0;
+        for ( size_t c = 0; c < chunks.size(); c++ )
+        {
+          Postings& list = chunks[c][t];
+          for ( size_t i = 0; i < list.size(); i++, posting++ )
+          {
+            if ( posting % g_indexSkipInterval == 0 ) {
+              ProgressionIndexSkip skip = { list[i], (unsigned int)( data.size() - deltaStart ) };
+              memcpy( &data[skipStart + ( posting / g_indexSkipInterval ) * sizeof( skip )], &skip, sizeof( skip ) );
+            } else
+              appendVarint( list[i] - previous, data );
+            previous = list[i];
+          }
+          Postings().swap( list );
+        }
+        term.size = (unsigned int)( data.size() - term.offset );
+        // Keeps the skip tables of the next term aligned
+        data.resize( ( data.size() + 3 ) & ~(size_t)3 );
+      }
+    }
+  public:
+    explicit ProgressionIndexBuilder( const ProgressionFileReader& _file ): file( _file ), corrupt( false ), postings( 0 )
+    {
+    }
+    // Collects and compresses the posting lists; false if the file is
+    // corrupt or has more progressions than an index can number
+    bool build( size_t threads )
+    {
+      if ( file.getProgressions() > 0xFFFFFFFFULL )
+        return false;
+      if ( !threads )
+        threads = ThreadPool::defaultSize();
+      size_t chunkCount = std::max( (size_t)1, std::min( threads, file.getBlockCount() ) );
+      chunks.assign( chunkCount, vector<Postings>( g_indexTerms ) );
+      locator.assign( (size_t)( ( file.getProgressions() + g_indexLocatorInterval - 1 ) / g_indexLocatorInterval ), 0 );
+      {
+        ThreadPool pool( threads );
+        for ( size_t c = 0; c < chunkCount; c++ )
+          pool.submit( [this, c, chunkCount]() {
+            collect( chunks[c], c * file.getBlockCount() / chunkCount, ( c + 1 ) * file.getBlockCount() / chunkCount );
+          } );
+      }
+      if ( corrupt )
+        return false;
+      terms.resize( g_indexTerms );
+      ranges.assign( threads * 4, vector<unsigned char>() );
+      {
+        ThreadPool pool( threads );
+        for ( size_t r = 0; r < ranges.size(); r++ )
+          pool.submit( [this, r]() {
+            encode( ranges[r], (unsigned int)( r * g_indexTerms / ranges.size() ), (unsigned int)( ( r + 1 ) * g_indexTerms / ranges.size() ) );
+          } );
+      }
+      chunks.clear();
+      postings = 0;
+      for ( size_t t = 0; t < terms.size(); t++ )
+        postings += terms[t].count;
+      return true;
+    }
+    unsigned long long getPostings() const
+    {
+      return postings;
+    }
+    bool save( const string& path )
+    {
+      ProgressionIndexHeader header;
+      memset( &header, 0, sizeof( header ) );
+      memcpy( header.magic, g_progressionIndexMagic, 4 );
+      header.version = g_progressionIndexVersion;
+      header.terms = g_indexTerms;
+      header.skipInterval = g_indexSkipInterval;
+      header.locatorInterval = g_indexLocatorInterval;
+      header.progressions = file.getProgressions();
+      header.steps = file.getSteps();
+      header.postings = postings;
+      unsigned long long offset = sizeof( header ) + terms.size() * sizeof( ProgressionIndexTerm );
+      for ( size_t r = 0, t = 0; r < ranges.size(); r++ )
+      {
+        for ( ; t < ( r + 1 ) * g_indexTerms / ranges.size(); t++ )
+          terms[t].offset += offset;
+        offset += ranges[r].size();
+      }
+      size_t padding = (size_t)( ( 8 - offset % 8 ) % 8 );
+      header.locatorOffset = offset + padding;
+      return saveFile( path, [&]( FILE* output ) {
+        const unsigned char zeros[8] = { 0 };
+        bool written = fwrite( &header, sizeof( header ), 1, output ) == 1
+          && fwrite( &terms[0], sizeof( ProgressionIndexTerm ), terms.size(), output ) == terms.size();
+        for ( size_t r = 0; written && r < ranges.size(); r++ )
+          written = ranges[r].empty() || fwrite( &ranges[r][0], 1, ranges[r].size(), output ) == ranges[r].size();
+        return written && fwrite( zeros, 1, padding, output ) == padding
+          && ( locator.empty() || fwrite( &locator[0], sizeof( unsigned long long ), locator.size(), output ) == locator.size() );
+      } );
+    }
+  };
+
+  class ProgressionIndexReader {
+  protected:
+    MappedFile file;
+    ProgressionIndexHeader header;
+    const ProgressionIndexTerm* terms;
+    const unsigned long long* locator;
+  public:
+    ProgressionIndexReader(): terms( NULL ), locator( NULL )
+    {
+    }
+    // Opens the index of the given progression file
+    ProgressionIndexResult open( const string& path, const ProgressionFileReader& progressions )
+    {
+      if ( !file.open( path ) )
+        return ProgressionIndex_CannotOpen;
+      if ( file.getSize() < sizeof( header ) )
+        return ProgressionIndex_NotIndex;
+      memcpy( &header, file.getData(), sizeof( header ) );
+      if ( memcmp( header.magic, g_progressionIndexMagic, 4 ) || header.version != g_progressionIndexVersion )
+        return ProgressionIndex_NotIndex;
+      unsigned long long locatorCount = ( header.progressions + g_indexLocatorInterval - 1 ) / g_indexLocatorInterval;
+      if ( header.terms != g_indexTerms || header.skipInterval != g_indexSkipInterval
+        || header.locatorInterval != g_indexLocatorInterval || header.locatorOffset % 8
+        || header.locatorOffset < sizeof( header ) + g_indexTerms * sizeof( ProgressionIndexTerm )
+        || header.locatorOffset > file.getSize() || ( file.getSize() - header.locatorOffset ) / 8 < locatorCount )
+        return ProgressionIndex_Corrupt;
+      if ( header.progressions != progressions.getProgressions() || header.steps != progressions.getSteps() )
+        return ProgressionIndex_OutOfDate;
+      terms = (const ProgressionIndexTerm*)( file.getData() + sizeof( header ) );
+      locator = (const unsigned long long*)( file.getData() + header.locatorOffset );
+      for ( unsigned int t = 0; t < g_indexTerms; t++ )
+      {
+        unsigned long long skipBytes = ( terms[t].count + g_indexSkipInterval - 1 ) / g_indexSkipInterval * sizeof( ProgressionIndexSkip );
+        if ( terms[t].offset % 4 || terms[t].offset > header.locatorOffset
+          || header.locatorOffset - terms[t].offset < terms[t].size || terms[t].size < skipBytes )
+          return ProgressionIndex_Corrupt;
+      }
+      return ProgressionIndex_OK;
+    }
+    unsigned long long getPostings() const
+    {
+      return header.postings;
+    }
+    PostingCursor getList( unsigned int term ) const
+    {
+      return PostingCursor( file.getData() + terms[term].offset, terms[term].size, terms[term].count );
+    }
+    // Reads a progression from the indexed file by its number
+    bool find( const ProgressionFileReader& progressions, unsigned int id, PackedProgression& progression ) const
+    {
+      if ( id >= header.progressions )
+        return false;
+      return progressions.find( locator[id / g_indexLocatorInterval], id % g_indexLocatorInterval, progression );
+    }
+  };
+
+  // Finds the progressions that contain a run of two or more chords, in
+  // any key, up to limit of them (0 for all). Runs of two or three chords are a single
+  // term and answered from the index alone. Longer runs intersect the
+  // lists of their trigrams, rarest first, and each progression in all of
+  // them is checked in the file, as the trigrams may be apart. Fails if
+  // the index or the file is corrupt.
+
+  inline bool findRun( const ProgressionIndexReader& index, const ProgressionFileReader& progressions,
+    const vector<Triad>& query, size_t limit, vector<unsigned int>& matches, unsigned long long& candidates )
+  {
+    matches.clear();
+    candidates = 0;
+    if ( query.size() < 2 )
+      return true;
+    vector<unsigned int> queryTerms;
+    if ( query.size() == 2 )
+      queryTerms.push_back( indexBigram( &query[0] ) );
+    for ( size_t i = 0; i + 2 < query.size(); i++ )
+      queryTerms.push_back( indexTrigram( &query[i] ) );
+    std::sort( queryTerms.begin(), queryTerms.end() );
+    queryTerms.erase( std::unique( queryTerms.begin(), queryTerms.end() ), queryTerms.end() );
+    vector<PostingCursor> lists;
+    for ( size_t i = 0; i < queryTerms.size(); i++ )
+      lists.push_back( index.getList( queryTerms[i] ) );
+    std::sort( lists.begin(), lists.end(), []( const PostingCursor& a, const PostingCursor& b ) {
+      return a.getCount() < b.getCount();
+    } );
+    ChordProgressionStep step( Degree_Tonic, Triad() );
+    vector<Triad> chords;
+    PackedProgression progression;
+    unsigned int target = 0;
+    while ( !limit || matches.size() < limit )
+    {
+      // Leapfrogs the lists forward until all of them agree on a number
+      size_t agreed = 0;
+      bool exhausted = false;
+      for ( size_t i = 0; agreed < lists.size() && !exhausted; i = ( i + 1 ) % lists.size() )
+      {
+        if ( !lists[i].seek( target ) )
+          exhausted = true;
+        else if ( lists[i].get() == target )
+          agreed++;
+        else {
+          target = lists[i].get();
+          agreed = 1;
+        }
+      }
+      if ( exhausted )
+        break;
+      candidates++;
+      bool match = query.size() <= 3;
+      if ( !match ) {
+        if ( !index.find( progressions, target, progression ) )
+          return false;
+        decodeChords( progression, step, chords );
+        match = containsRun( chords, query );
+      }
+      if ( match )
+        matches.push_back( target );
+      if ( target == 0xFFFFFFFF )
+        break;
+      target++;
+    }
+    for ( size_t i = 0; i < lists.size(); i++ )
+      if ( lists[i].isCorrupt() )
+        return false;
+    return true;
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticPitchClassSet.h"
+
+namespace chromatic {
+
+  // Set of major and minor scales, one bit per scale at mode * 12 + root
+
+  typedef unsigned int ScaleSet;
+
+  const ScaleSet g_allScales = 0xFFFFFF;
+
+  inline ScaleSet scaleBit( Note root, ScaleMode mode )
+  {
+    return 1u << ( mode * 12 + root );
+  }
+
+  inline PitchClassSet scalePitchClasses( const Scale& scale )
+  {
+    PitchClassSet set;
+    const Note* notes = scale.getNotes();
+    for ( int i = 0; i < scale.getDegreeCount(); i++ )
+      set.add( notes[i] );
+    return set;
+  }
+
+  // Every major and minor scale containing a given pitch class set. Each scale marks
+  // all 128 subsets of its own notes, so building the table is cheap.
+
+  class ScaleMembershipTable {
+  protected:
+    ScaleSet entries[4096];
+  public:
+    ScaleMembershipTable()
+    {
+      memset( entries, 0, sizeof( entries ) );
+      for ( int mode = ScaleMode_Minor; mode <= ScaleMode_Major; mode++ )
+        for ( int root = Note_C; root <= Note_B; root++ )
+        {
+          unsigned int notes = scalePitchClasses( Scale( (Note)root, (ScaleMode)mode ) ).mask;
+          ScaleSet bit = scaleBit( (Note)root, (ScaleMode)mode );
+          for ( unsigned int subset = notes; ; subset = ( subset - 1 ) & notes )
+          {
+            entries[subset] |= bit;
+            if ( !subset )
+              break;
+          }
+        }
+    }
+    ScaleSet operator[]( const PitchClassSet& set ) const
+    {
+      return entries[set.mask];
+    }
+  };
+
+  const ScaleMembershipTable g_scaleMembership;
+
+  inline ScaleSet scalesContaining( const PitchClassSet& set )
+  {
+    return g_scaleMembership[set];
+  }
+
+  inline ScaleSet scalesContaining( const Triad& chord )
+  {
+    return g_scaleMembership[PitchClassSet( chord )];
+  }
+
+  ScaleSet scalesContaining( const TriadVector& chords )
+  {
+    ScaleSet scales = g_allScales;
+    for ( TriadVector::const_iterator it = chords.begin(); it != chords.end() && scales; ++it )
+      scales &= scalesContaining( *it );
+    return scales;
+  }
+
+}
\ No newline at end of file
@@ -22,233 +22,283 @@
 #include <iostream>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
-#include <boost/tokenizer.hpp>
+#include <boost/utility/string_view.hpp>
 
 #include "chromaticTypes.h"
 #include "chromaticChords.h"
 
 namespace chromatic {
 
-  using std::wstring;
+  using std::string;
   using std::vector;
 
-  typedef Semitones DiatonicScaleDef [7];
-  typedef ChordType DiatonicScaleChordDef [7];
+  // Scale modes index the scale library below. The built-in modes come
+  // first, minor and major at 0 and 1; modes loaded from a file follow.
 
-  const DiatonicScaleDef g_diatonicScaleDefMajor = {
-    2, 2, 1, 2, 2, 2, 1
+  enum ScaleMode: unsigned char {
+    ScaleMode_Minor = 0,
+    ScaleMode_Major,
+    ScaleMode_Dorian,
+    ScaleMode_Phrygian,
+    ScaleMode_Lydian,
+    ScaleMode_Mixolydian,
+    ScaleMode_Locrian,
+    ScaleMode_HarmonicMinor,
+    ScaleMode_MelodicMinor,
+    ScaleMode_MajorPentatonic,
+    ScaleMode_MinorPentatonic,
+    ScaleMode_Blues
   };
 
-  const DiatonicScaleChordDef g_diatonicScaleChordsMajor = {
-    ChordType_Major,
-    ChordType_Minor,
-    ChordType_Minor,
-    ChordType_Major,
-    ChordType_Major,
-    ChordType_Minor,
-    ChordType_Diminished
+  const int g_scaleModesMax = 64;
+
+  // Built-in modes as masks of the semitones above the root, lowest bit
+  // for the root itself
+
+  struct ScaleModeDef {
+    const char* key;
+    const char* name;
+    unsigned short pattern;
   };
 
-  const wchar_t* g_DiatonicScaleDegreesMajor[7] = {
-    L"I", L"ii", L"iii", L"IV", L"V", L"vi", L"vii"
+  const ScaleModeDef g_builtinScaleModes[12] = {
+    { "minor", "Minor", 0x5AD },
+    { "major", "Major", 0xAB5 },
+    { "dorian", "Dorian", 0x6AD },
+    { "phrygian", "Phrygian", 0x5AB },
+    { "lydian", "Lydian", 0xAD5 },
+    { "mixolydian", "Mixolydian", 0x6B5 },
+    { "locrian", "Locrian", 0x56B },
+    { "harmonic-minor", "Harmonic Minor", 0x9AD },
+    { "melodic-minor", "Melodic Minor", 0xAAD },
+    { "major-pentatonic", "Major Pentatonic", 0x295 },
+    { "minor-pentatonic", "Minor Pentatonic", 0x4A9 },
+    { "blues", "Blues", 0x4E9 }
   };
 
-  const DiatonicScaleDef g_diatonicScaleDefMinor = {
-    2, 1, 2, 2, 1, 2, 2
+  struct ScaleModeAlias {
+    const char* key;
+    ScaleMode mode;
   };
 
-  const DiatonicScaleChordDef g_diatonicScaleChordsMinor = {
-    ChordType_Minor,
-    ChordType_Diminished,
+  const ScaleModeAlias g_scaleModeAliases[3] = {
+    { "ionian", ScaleMode_Major },
+    { "aeolian", ScaleMode_Minor },
+    { "pentatonic", ScaleMode_MajorPentatonic }
+  };
+
+  // Triad types tried on each degree, in order of preference
+
+  const ChordType g_scaleTriadOrder[6] = {
     ChordType_Major,
     ChordType_Minor,
-    ChordType_Minor,
-    ChordType_Major,
-    ChordType_Major
+    ChordType_Diminished,
+    ChordType_Augmented,
+    ChordType_SuspendedFourth,
+    ChordType_SuspendedSecond
   };
 
-  const wchar_t* g_DiatonicScaleDegreesMinor[7] = {
-    L"i", L"ii", L"III", L"iv", L"v", L"VI", L"VII"
+  // Degrees are numbered in uppercase for chords with a major third or
+  // none, and in lowercase for chords with a minor third
+
+  const char* g_numeralsUpper[7] = {
+    "I", "II", "III", "IV", "V", "VI", "VII"
   };
 
-  enum DiatonicScaleMode: int {
-    ScaleMode_Minor = 0,
-    ScaleMode_Major
+  const char* g_numeralsLower[7] = {
+    "i", "ii", "iii", "iv", "v", "vi", "vii"
   };
 
-  const wchar_t* g_scaleModesStr[2] = {
-    L"Minor", L"Major"
+  // Everything about a mode that does not depend on the root, derived
+  // from its pattern when the mode is added
+
+  struct ScaleModeInfo {
+    string key;
+    string name;
+    unsigned short pattern;
+    int degreeCount;
+    unsigned char triadDegrees;
+    Semitones offsets[7];
+    ChordType chords[7];
+    const char* numerals[7];
   };
 
-  class Scale {
-  protected:
-    wstring _name;
-    wstring _str;
-  public:
-    virtual const wstring& getName() = 0;
-    virtual cosnt wstring& getString() = 0;
+  // A mode on a given root
+
+  struct ScaleInfo {
+    Note notes[7];
+    string name;
+    string noteString;
   };
 
-  class DiatonicScale: public Scale {
+  class ScaleLibrary {
   protected:
-    DiatonicScaleMode mode;
-  public:
-    Note notes[7];
-    DiatonicScale( Note root, DiatonicScaleMode _mode ): mode( _mode )
-    {
-      switch ( mode ) {
-        case ScaleMode_Major:
-          notes[0] = root;
-          for ( int i = 1; i < 7; i++ )
-            notes[i] = notes[i-1] + g_diatonicScaleDefMajor[i-1];
-        break;
-        case ScaleMode_Minor:
-          notes[0] = root;
-          for ( int i = 1; i < 7; i++ )
-            notes[i] = notes[i-1] + g_diatonicScaleDefMinor[i-1];
-        break;
-      }
+    ScaleModeInfo modes[g_scaleModesMax];
+    ScaleInfo scales[g_scaleModesMax][12];
+    int count;
+    // Keys are stored in lowercase
+    static bool keyEquals( const boost::string_view& key, const boost::string_view& lower )
+    {
+      if ( key.length() != lower.length() )
+        return false;
+      for ( size_t i = 0; i < key.length(); i++ )
+        if ( lowerAscii( key[i] ) != lower[i] )
+          return false;
+      return true;
     }
-    void print()
+  public:
+    ScaleLibrary(): count( 0 )
     {
-      wprintf_s( L"Scale %s:\r\n", getName().c_str() );
-      wprintf_s( L"- %s\r\n", getString().c_str() );
-      wprintf_s( L"Chords in %s:\r\n", getName().c_str() );
-      for ( Degree i = Degree_Tonic; i <= Degree_Subsemitone; i++ )
-        wprintf_s( L"- %s\r\n", getTriad( i ).getName().c_str() );
+      for ( int i = 0; i < 12; i++ )
+        add( g_builtinScaleModes[i].key, g_builtinScaleModes[i].name, g_builtinScaleModes[i].pattern );
     }
-    const wchar_t* getDegree( Degree degree )
+    // Adds a mode from its pattern. Fails if the library is full or the
+    // pattern does not contain the root and between two and seven notes.
+    bool add( const string& key, const string& name, unsigned short pattern )
     {
-      switch ( mode )
+      if ( count >= g_scaleModesMax || !( pattern & 1 ) || pattern > 0xFFF || find( key ) >= 0 )
+        return false;
+      ScaleModeInfo& mode = modes[count];
+      mode.key = key;
+      for ( size_t i = 0; i < mode.key.length(); i++ )
+        mode.key[i] = lowerAscii( mode.key[i] );
+      mode.name = name;
+      mode.pattern = pattern;
+      mode.degreeCount = 0;
+      mode.triadDegrees = 0;
+      for ( int semitone = 0; semitone < Interval_Octave; semitone++ )
       {
-        case ScaleMode_Major:
-        default:
-          return g_DiatonicScaleDegreesMajor[degree];
-        break;
-        case ScaleMode_Minor:
-          return g_DiatonicScaleDegreesMinor[degree];
-        break;
+        if ( !( pattern & ( 1 << semitone ) ) )
+          continue;
+        if ( mode.degreeCount == 7 )
+          return false;
+        mode.offsets[mode.degreeCount++] = semitone;
       }
-    }
-    Triad getTriad( Degree degree )
-    {
-      switch ( mode )
+      if ( mode.degreeCount < 2 )
+        return false;
+      for ( int degree = 0; degree < 7; degree++ )
       {
-        case ScaleMode_Major:
-        default:
-          return Triad( notes[degree], g_diatonicScaleChordsMajor[degree] );
-        break;
-        case ScaleMode_Minor:
-          return Triad( notes[degree], g_diatonicScaleChordsMinor[degree] );
-        break;
+        mode.chords[degree] = ChordType_Major;
+        mode.numerals[degree] = g_numeralsUpper[degree];
       }
-    }
-    const wstring& getName()
-    {
-      if ( _name.empty() )
+      for ( int degree = 0; degree < mode.degreeCount; degree++ )
       {
-        _name.resize( 16 );
-        int chars = swprintf_s( &_name[0], 16, L"%s %s", g_notesSharpStr[notes[0]], g_scaleModesStr[mode] );
-        if ( chars < 16 )
-          _name.reserve( chars );
+        Semitones offset = mode.offsets[degree];
+        for ( int i = 0; i < 6; i++ )
+        {
+          ChordType type = g_scaleTriadOrder[i];
+          const Note* notes = g_triadNotes[offset][type];
+          if ( !( pattern & ( 1 << notes[1] ) ) || !( pattern & ( 1 << notes[2] ) ) )
+            continue;
+          mode.chords[degree] = type;
+          mode.triadDegrees |= (unsigned char)( 1 << degree );
+          if ( type == ChordType_Minor || type == ChordType_Diminished )
+            mode.numerals[degree] = g_numeralsLower[degree];
+          break;
+        }
       }
-      return _name;
-    }
-    const wstring& getString()
-    {
-      if ( _str.empty() )
+      for ( int root = Note_C; root <= Note_B; root++ )
       {
-        _str.resize( 32 );
-        int chars = swprintf_s( &_str[0], 32, L"%s-%s-%s-%s-%s-%s-%s",
-          g_notesSharpStr[notes[0]],
-          g_notesSharpStr[notes[1]],
-          g_notesSharpStr[notes[2]],
-          g_notesSharpStr[notes[3]],
-          g_notesSharpStr[notes[4]],
-          g_notesSharpStr[notes[5]],
-          g_notesSharpStr[notes[6]]
-        );
-        if ( chars < 32 )
-          _str.reserve( chars );
+        ScaleInfo& scale = scales[count][root];
+        scale.name = g_notesSharpStr[root];
+        scale.name.append( " " );
+        scale.name.append( name );
+        scale.noteString.clear();
+        for ( int degree = 0; degree < 7; degree++ )
+          scale.notes[degree] = (Note)root;
+        for ( int degree = 0; degree < mode.degreeCount; degree++ )
+        {
+          scale.notes[degree] = (Note)( ( root + mode.offsets[degree] ) % Interval_Octave );
+          if ( degree )
+            scale.noteString.append( "-" );
+          scale.noteString.append( g_notesSharpStr[scale.notes[degree]] );
+        }
       }
-      return _str;
+      count++;
+      return true;
+    }
+    // Mode with the given key, case insensitive, or -1
+    int find( const boost::string_view& key ) const
+    {
+      for ( int i = 0; i < 3; i++ )
+        if ( keyEquals( key, g_scaleModeAliases[i].key ) )
+          return g_scaleModeAliases[i].mode;
+      for ( int i = 0; i < count; i++ )
+        if ( keyEquals( key, modes[i].key ) )
+          return i;
+      return -1;
+    }
+    int size() const
+    {
+      return count;
+    }
+    const ScaleModeInfo& getMode( ScaleMode mode ) const
+    {
+      return modes[mode];
+    }
+    const ScaleInfo& getScale( Note root, ScaleMode mode ) const
+    {
+      return scales[mode][root];
     }
   };
 
-  struct ChordProgressionStep {
-    wstring str;
-    Triad chord;
-    ChordProgressionStep( const wstring& _str, Triad _chord ):
-    str( _str ), chord( _chord ) {}
-  };
-
-  typedef vector<ChordProgressionStep> ProgressionVector;
+  ScaleLibrary g_scales;
 
-  typedef vector<Triad> TriadVector;
-  typedef vector<wstring> StringVector;
-  typedef boost::char_separator<wchar_t,wstring::traits_type> CharSeparator;
-  typedef boost::tokenizer<CharSeparator,wstring::const_iterator,wstring> CharTokenizer;
+  // A scale is just its root and mode; notes, chords and names are looked
+  // up from the library.
 
-  void explode( const wstring& str, wstring delims, StringVector& v )
-  {
-    CharSeparator sep( delims.c_str() );
-    CharTokenizer tokenizer( str, sep );
-    for ( CharTokenizer::iterator it = tokenizer.begin(); it != tokenizer.end(); ++it )
+  class Scale {
+  protected:
+    Note root;
+    ScaleMode mode;
+  public:
+    Scale(): root( Note_C ), mode( ScaleMode_Major )
     {
-      v.push_back( *it );
     }
-  }
-
-  wstring implode( const ProgressionVector& v, wstring delim )
-  {
-    std::wostringstream str;
-    for ( ProgressionVector::const_iterator it = v.begin(); it != v.end(); ++it )
+    Scale( Note _root, ScaleMode _mode ): root( _root ), mode( _mode )
     {
-      if ( it != v.begin() )
-        str << delim;
-      str << (*it).str;
+      CHROMATIC_STATS_COUNT( Stats_Scale );
     }
-    return str.str();
-  }
-
-  class ChordProgression {
-  protected:
-    ProgressionVector progression;
-    DiatonicScale scale;
-  public:
-    void print()
+    Note getRoot() const
     {
-      wstring prog = implode( progression, L"-" );
-      wprintf_s( L"Chord progression %s in %s:\r\n", prog.c_str(), scale.getName().c_str() );
-      for ( ProgressionVector::iterator it = progression.begin(); it != progression.end(); ++it )
-      {
-        wprintf_s( L"- %s\r\n", (*it).chord.getName().c_str() );
-        wprintf_s( L"  %s\r\n", (*it).chord.getString().c_str() );
-      }
+      return root;
     }
-    ChordProgression( DiatonicScale _scale, wstring _progression ):
-    scale( _scale )
+    ScaleMode getMode() const
     {
-      StringVector chordtypes;
-      explode( _progression, L"-", chordtypes );
-      for ( StringVector::iterator it = chordtypes.begin(); it != chordtypes.end(); ++it )
-      {
-        if ( boost::iequals( (*it), L"i" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Tonic ), scale.getTriad( Degree_Tonic ) ) );
-        } else if ( boost::iequals( (*it), L"ii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Supertonic ), scale.getTriad( Degree_Supertonic ) ) );
-        } else if ( boost::iequals( (*it), L"iii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Mediant ), scale.getTriad( Degree_Mediant ) ) );
-        } else if ( boost::iequals( (*it), L"iv" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Subdominant ), scale.getTriad( Degree_Subdominant ) ) );
-        } else if ( boost::iequals( (*it), L"v" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Dominant ), scale.getTriad( Degree_Dominant ) ) );
-        } else if ( boost::iequals( (*it), L"vi" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Submediant ), scale.getTriad( Degree_Submediant ) ) );
-        } else if ( boost::iequals( (*it), L"vii" ) ) {
-          progression.push_back( ChordProgressionStep( scale.getDegree( Degree_Subsemitone ), scale.getTriad( Degree_Subsemitone ) ) );
-        }
-      }
+      return mode;
+    }
+    int getDegreeCount() const
+    {
+      return g_scales.getMode( mode ).degreeCount;
+    }
+    const Note* getNotes() const
+    {
+      return g_scales.getScale( root, mode ).notes;
+    }
+    const char* getDegree( Degree degree ) const
+    {
+      return g_scales.getMode( mode ).numerals[degree];
+    }
+    // Mask of the degrees that have a triad made of notes of the scale
+    unsigned char getTriadDegrees() const
+    {
+      return g_scales.getMode( mode ).triadDegrees;
+    }
+    bool hasTriad( Degree degree ) const
+    {
+      return ( getTriadDegrees() & ( 1 << degree ) ) != 0;
+    }
+    Triad getTriad( Degree degree ) const
+    {
+      return Triad( g_scales.getScale( root, mode ).notes[degree], g_scales.getMode( mode ).chords[degree] );
+    }
+    const char* getName() const
+    {
+      return g_scales.getScale( root, mode ).name.c_str();
+    }
+    const char* getString() const
+    {
+      return g_scales.getScale( root, mode ).noteString.c_str();
     }
   };
 
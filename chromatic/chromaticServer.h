@@ -0,0 +1,365 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifdef __linux__
+#define CHROMATIC_SERVE
+#endif
+
+#ifdef CHROMATIC_SERVE
+
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace chromatic {
+
+  using std::vector;
+
+  // Stop reading from a connection while this much output is waiting for it
+  const size_t g_serveMaxPending = 1 << 20;
+
+  // Connections sending longer lines than this are dropped
+  const size_t g_serveMaxLine = 1 << 16;
+
+  const size_t g_serveReadSize = 1 << 16;
+
+  inline bool fillSocketAddress( const char* path, sockaddr_un& address )
+  {
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof( address.sun_path ) )
+      return false;
+    strcpy( address.sun_path, path );
+    return true;
+  }
+
+  // Removes a socket left behind by a server that is no longer running.
+  // Anything else at the path, the socket of a running server included, is
+  // left alone and fails with EADDRINUSE.
+  inline bool removeStaleSocket( const char* path, const sockaddr_un& address )
+  {
+    struct stat info;
+    if ( lstat( path, &info ) < 0 )
+      return errno == ENOENT;
+    if ( S_ISSOCK( info.st_mode ) ) {
+      int probe = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+      bool refused = probe >= 0 && connect( probe, (const sockaddr*)&address, sizeof( address ) ) < 0 && errno == ECONNREFUSED;
+      if ( probe >= 0 )
+        ::close( probe );
+      if ( refused )
+        return unlink( path ) == 0 || errno == ENOENT;
+    }
+    errno = EADDRINUSE;
+    return false;
+  }
+
+  // Line-based server on a Unix domain socket, driven by a single-threaded
+  // epoll loop. Every complete line received is answered through the
+  // handler, in order, so clients may pipeline as many requests as they
+  // like. Output is written as far as the socket takes it and the rest is
+  // kept until the connection is writable again.
+
+  class UnixSocketServer {
+  public:
+    typedef std::function<void( const char* line, size_t length, std::string& output )> LineHandler;
+  protected:
+    struct Connection {
+      int fd;
+      std::string input;
+      std::string output;
+      size_t sent;
+      bool closing;
+      unsigned int events;
+    };
+    int listener;
+    int poller;
+    std::string path;
+    LineHandler handler;
+    unsigned long long connections;
+    unsigned long long requests;
+    UnixSocketServer( const UnixSocketServer& );
+    UnixSocketServer& operator=( const UnixSocketServer& );
+    void drop( Connection* connection )
+    {
+      epoll_ctl( poller, EPOLL_CTL_DEL, connection->fd, NULL );
+      ::close( connection->fd );
+      delete connection;
+    }
+    void accept()
+    {
+      int fd;
+      while ( ( fd = accept4( listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 )
+      {
+        Connection* connection = new Connection();
+        connection->fd = fd;
+        connection->sent = 0;
+        connection->closing = false;
+        connection->events = EPOLLIN;
+        epoll_event event;
+        event.events = connection->events;
+        event.data.ptr = connection;
+        if ( epoll_ctl( poller, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+          ::close( fd );
+          delete connection;
+          continue;
+        }
+        connections++;
+      }
+    }
+    // Reads what is available, returning false if the connection failed
+    bool receive( Connection* connection )
+    {
+      char chunk[g_serveReadSize];
+      for ( ;; )
+      {
+        ssize_t count = recv( connection->fd, chunk, sizeof( chunk ), 0 );
+        if ( count > 0 ) {
+          connection->input.append( chunk, (size_t)count );
+          if ( (size_t)count < sizeof( chunk ) )
+            return true;
+        } else if ( count == 0 ) {
+          // Answer a last line that was not terminated
+          if ( !connection->input.empty() && connection->input[connection->input.length() - 1] != '\n' )
+            connection->input.push_back( '\n' );
+          connection->closing = true;
+          return true;
+        } else
+          return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+    }
+    bool answer( Connection* connection )
+    {
+      std::string& input = connection->input;
+      size_t start = 0;
+      const char* newline;
+      while ( ( newline = (const char*)memchr( input.data() + start, '\n', input.length() - start ) ) != NULL )
+      {
+        size_t end = newline - input.data();
+        handler( input.data() + start, end - start, connection->output );
+        requests++;
+        start = end + 1;
+      }
+      input.erase( 0, start );
+      return input.length() <= g_serveMaxLine;
+    }
+    bool send( Connection* connection )
+    {
+      std::string& output = connection->output;
+      while ( connection->sent < output.length() )
+      {
+        ssize_t count = ::send( connection->fd, output.data() + connection->sent,
+          output.length() - connection->sent, MSG_NOSIGNAL );
+        if ( count < 0 )
+          return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        connection->sent += (size_t)count;
+      }
+      output.clear();
+      connection->sent = 0;
+      return true;
+    }
+    // Waits for whatever the connection needs next, or closes it when done
+    void update( Connection* connection )
+    {
+      size_t pending = connection->output.length() - connection->sent;
+      if ( connection->closing && !pending ) {
+        drop( connection );
+        return;
+      }
+      unsigned int events = 0;
+      if ( !connection->closing && pending < g_serveMaxPending )
+        events |= EPOLLIN;
+      if ( pending )
+        events |= EPOLLOUT;
+      if ( events == connection->events )
+        return;
+      connection->events = events;
+      epoll_event event;
+      event.events = events;
+      event.data.ptr = connection;
+      epoll_ctl( poller, EPOLL_CTL_MOD, connection->fd, &event );
+    }
+    void serve( Connection* connection, unsigned int events )
+    {
+      if ( events & ( EPOLLERR | EPOLLHUP ) && !( events & EPOLLIN ) ) {
+        drop( connection );
+        return;
+      }
+      if ( events & EPOLLIN ) {
+        if ( !receive( connection ) || !answer( connection ) ) {
+          drop( connection );
+          return;
+        }
+      }
+      if ( !send( connection ) ) {
+        drop( connection );
+        return;
+      }
+      update( connection );
+    }
+  public:
+    explicit UnixSocketServer( const LineHandler& _handler ):
+    listener( -1 ), poller( -1 ), handler( _handler ), connections( 0 ), requests( 0 )
+    {
+    }
+    ~UnixSocketServer()
+    {
+      close();
+    }
+    bool open( const char* _path )
+    {
+      sockaddr_un address;
+      if ( !fillSocketAddress( _path, address ) )
+        return false;
+      listener = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+      if ( listener < 0 )
+        return false;
+      if ( !removeStaleSocket( _path, address ) ) {
+        close();
+        return false;
+      }
+      if ( bind( listener, (const sockaddr*)&address, sizeof( address ) ) < 0 || listen( listener, SOMAXCONN ) < 0 ) {
+        close();
+        return false;
+      }
+      path = _path;
+      poller = epoll_create1( EPOLL_CLOEXEC );
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.ptr = NULL;
+      if ( poller < 0 || epoll_ctl( poller, EPOLL_CTL_ADD, listener, &event ) < 0 ) {
+        close();
+        return false;
+      }
+      return true;
+    }
+    // Serves until the stop flag is raised, usually from a signal handler
+    void run( volatile sig_atomic_t& stop )
+    {
+      epoll_event events[64];
+      while ( !stop )
+      {
+        int count = epoll_wait( poller, events, 64, -1 );
+        for ( int i = 0; i < count; i++ )
+        {
+          if ( !events[i].data.ptr )
+            accept();
+          else
+            serve( (Connection*)events[i].data.ptr, events[i].events );
+        }
+      }
+    }
+    // Stops listening. Open connections are left to the process exit.
+    void close()
+    {
+      if ( poller >= 0 )
+        ::close( poller );
+      if ( listener >= 0 )
+        ::close( listener );
+      if ( !path.empty() )
+        unlink( path.c_str() );
+      poller = listener = -1;
+      path.clear();
+    }
+    unsigned long long getConnections() const
+    {
+      return connections;
+    }
+    unsigned long long getRequests() const
+    {
+      return requests;
+    }
+  };
+
+  // Blocking client for a line-based Unix domain socket server
+
+  class UnixSocketClient {
+  protected:
+    int fd;
+    UnixSocketClient( const UnixSocketClient& );
+    UnixSocketClient& operator=( const UnixSocketClient& );
+  public:
+    UnixSocketClient(): fd( -1 )
+    {
+    }
+    ~UnixSocketClient()
+    {
+      close();
+    }
+    bool open( const char* path )
+    {
+      sockaddr_un address;
+      if ( !fillSocketAddress( path, address ) )
+        return false;
+      fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+      if ( fd < 0 )
+        return false;
+      if ( connect( fd, (const sockaddr*)&address, sizeof( address ) ) < 0 ) {
+        close();
+        return false;
+      }
+      return true;
+    }
+    void close()
+    {
+      if ( fd >= 0 )
+        ::close( fd );
+      fd = -1;
+    }
+    bool send( const char* data, size_t length )
+    {
+      while ( length )
+      {
+        ssize_t count = ::send( fd, data, length, MSG_NOSIGNAL );
+        if ( count < 0 && errno == EINTR )
+          continue;
+        if ( count <= 0 )
+          return false;
+        data += count;
+        length -= (size_t)count;
+      }
+      return true;
+    }
+    // Appends what arrives next, returning false once the server is gone
+    bool receive( std::string& buffer )
+    {
+      char chunk[g_serveReadSize];
+      ssize_t count;
+      while ( ( count = recv( fd, chunk, sizeof( chunk ), 0 ) ) < 0 && errno == EINTR )
+        ;
+      if ( count <= 0 )
+        return false;
+      buffer.append( chunk, (size_t)count );
+      return true;
+    }
+  };
+
+}
+
+#endif
\ No newline at end of file
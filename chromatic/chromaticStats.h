@@ -0,0 +1,243 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+// Counters and timers on the hot paths, reported with --stats. They exist
+// only when CHROMATIC_STATS is defined; otherwise the macros below expand
+// to nothing and cost nothing.
+
+#ifdef CHROMATIC_STATS
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "chromaticAllocations.h"
+
+namespace chromatic {
+
+  using std::vector;
+
+  enum StatsStage: int {
+    Stats_Query = 0,
+    Stats_Tokenize,
+    Stats_ParseChord,
+    Stats_ParseScale,
+    Stats_ParseProgression,
+    Stats_Format,
+    Stats_Flush,
+    Stats_Triad,
+    Stats_Scale,
+    Stats_Count
+  };
+
+  const char* g_statsStagesStr[Stats_Count] = {
+    "query",
+    "tokenize",
+    "parse/chord",
+    "parse/scale",
+    "parse/progression",
+    "format",
+    "flush",
+    "construct/triad",
+    "construct/scale"
+  };
+
+  // Latencies are kept in a histogram of eight buckets per power of two,
+  // so percentiles are exact to within an eighth.
+
+  const int g_statsBuckets = 512;
+
+  inline int statsBucket( unsigned long long nanoseconds )
+  {
+    if ( nanoseconds < 16 )
+      return (int)nanoseconds;
+    int exponent = 4;
+    while ( nanoseconds >> ( exponent + 1 ) )
+      exponent++;
+    return 16 + ( exponent - 4 ) * 8 + (int)( ( nanoseconds >> ( exponent - 3 ) ) & 7 );
+  }
+
+  // Largest latency that falls in a bucket
+  inline unsigned long long statsBucketLimit( int bucket )
+  {
+    if ( bucket < 16 )
+      return (unsigned long long)bucket;
+    int shift = ( bucket - 16 ) / 8 + 1;
+    return ( ( 8ULL + ( bucket - 16 ) % 8 + 1 ) << shift ) - 1;
+  }
+
+  struct StageStats {
+    unsigned long long calls;
+    unsigned long long nanoseconds;
+    unsigned long long allocations;
+    unsigned long long maximum;
+    unsigned long long histogram[g_statsBuckets];
+  };
+
+  // Every thread counts into its own block, so that counting takes no
+  // locks or atomics; the blocks are kept until exit and summed when the
+  // statistics are printed, after all worker threads are done.
+
+  struct ThreadStats {
+    StageStats stages[Stats_Count];
+  };
+
+  class StatsRegistry {
+  protected:
+    std::mutex lock;
+    vector<ThreadStats*> threads;
+  public:
+    ThreadStats* add()
+    {
+      ThreadStats* stats = new ThreadStats();
+      std::lock_guard<std::mutex> guard( lock );
+      threads.push_back( stats );
+      return stats;
+    }
+    void sum( StageStats stages[Stats_Count] )
+    {
+      std::lock_guard<std::mutex> guard( lock );
+      memset( stages, 0, sizeof( StageStats ) * Stats_Count );
+      for ( size_t i = 0; i < threads.size(); i++ )
+      {
+        for ( int stage = 0; stage < Stats_Count; stage++ )
+        {
+          const StageStats& from = threads[i]->stages[stage];
+          StageStats& to = stages[stage];
+          to.calls += from.calls;
+          to.nanoseconds += from.nanoseconds;
+          to.allocations += from.allocations;
+          to.maximum = std::max( to.maximum, from.maximum );
+          for ( int bucket = 0; bucket < g_statsBuckets; bucket++ )
+            to.histogram[bucket] += from.histogram[bucket];
+        }
+      }
+    }
+  };
+
+  StatsRegistry g_statsRegistry;
+  thread_local ThreadStats* t_stats = NULL;
+
+  inline StageStats& stageStats( StatsStage stage )
+  {
+    if ( !t_stats )
+      t_stats = g_statsRegistry.add();
+    return t_stats->stages[stage];
+  }
+
+  inline void countStats( StatsStage stage )
+  {
+    stageStats( stage ).calls++;
+  }
+
+  // Times a stage from construction to destruction. Nested stages are
+  // included in the time and allocations of the stages around them.
+
+  class StatsScope {
+  protected:
+    StatsStage stage;
+    unsigned long long allocations;
+    std::chrono::steady_clock::time_point start;
+  public:
+    explicit StatsScope( StatsStage _stage ): stage( _stage ), allocations( t_allocations ),
+    start( std::chrono::steady_clock::now() )
+    {
+    }
+    ~StatsScope()
+    {
+      unsigned long long nanoseconds = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start ).count();
+      StageStats& stats = stageStats( stage );
+      stats.calls++;
+      stats.nanoseconds += nanoseconds;
+      stats.allocations += t_allocations - allocations;
+      stats.maximum = std::max( stats.maximum, nanoseconds );
+      stats.histogram[statsBucket( nanoseconds )]++;
+    }
+  };
+
+  inline unsigned long long statsPercentile( const StageStats& stats, double fraction )
+  {
+    unsigned long long rank = (unsigned long long)( fraction * stats.calls + 0.5 ), seen = 0;
+    for ( int bucket = 0; bucket < g_statsBuckets; bucket++ )
+    {
+      seen += stats.histogram[bucket];
+      if ( seen >= rank && seen )
+        return std::min( statsBucketLimit( bucket ), stats.maximum );
+    }
+    return stats.maximum;
+  }
+
+  // Prints every stage that was reached, as a table or as one JSON object.
+  // Stages that are only counted have no latencies.
+
+  void printStats( FILE* stream, bool json )
+  {
+    static StageStats stages[Stats_Count];
+    g_statsRegistry.sum( stages );
+    if ( json )
+      fprintf( stream, "{\"type\":\"stats\",\"allocations\":%llu,\"stages\":[", g_allocations.load() );
+    else
+      fprintf( stream, "%-20s %12s %10s %9s %9s %9s %9s %9s %10s\n",
+        "Stage", "Calls", "Total ms", "Mean ns", "p50 ns", "p90 ns", "p99 ns", "Max ns", "Allocs" );
+    bool first = true;
+    for ( int i = 0; i < Stats_Count; i++ )
+    {
+      const StageStats& stats = stages[i];
+      if ( !stats.calls )
+        continue;
+      bool timed = stats.histogram[statsBucket( stats.maximum )] != 0;
+      if ( json ) {
+        fprintf( stream, "%s{\"name\":\"%s\",\"calls\":%llu", first ? "" : ",", g_statsStagesStr[i], stats.calls );
+        if ( timed )
+          fprintf( stream, ",\"total_ns\":%llu,\"mean_ns\":%.1f,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu,\"allocations\":%llu",
+            stats.nanoseconds, (double)stats.nanoseconds / stats.calls, statsPercentile( stats, 0.5 ),
+            statsPercentile( stats, 0.9 ), statsPercentile( stats, 0.99 ), stats.maximum, stats.allocations );
+        fprintf( stream, "}" );
+      } else if ( timed )
+        fprintf( stream, "%-20s %12llu %10.3f %9.1f %9llu %9llu %9llu %9llu %10llu\n",
+          g_statsStagesStr[i], stats.calls, stats.nanoseconds / 1e6, (double)stats.nanoseconds / stats.calls,
+          statsPercentile( stats, 0.5 ), statsPercentile( stats, 0.9 ), statsPercentile( stats, 0.99 ),
+          stats.maximum, stats.allocations );
+      else
+        fprintf( stream, "%-20s %12llu\n", g_statsStagesStr[i], stats.calls );
+      first = false;
+    }
+    if ( json )
+      fprintf( stream, "]}\n" );
+    else
+      fprintf( stream, "%llu heap allocations in total\n", g_allocations.load() );
+  }
+
+}
+
+#define CHROMATIC_STATS_SCOPE( stage ) chromatic::StatsScope statsScope( chromatic::stage )
+#define CHROMATIC_STATS_COUNT( stage ) chromatic::countStats( chromatic::stage )
+
+#else
+
+#define CHROMATIC_STATS_SCOPE( stage )
+#define CHROMATIC_STATS_COUNT( stage )
+
+#endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace chromatic {
+
+  using std::vector;
+
+  // Work-stealing thread pool. Tasks are handed out round-robin to per-worker
+  // queues; a worker runs its own queue oldest first and, when it runs dry,
+  // steals the newest task from another worker before going to sleep.
+
+  class ThreadPool {
+  public:
+    typedef std::function<void()> Task;
+  protected:
+    struct Worker {
+      std::mutex lock;
+      std::deque<Task> tasks;
+    };
+    vector<Worker*> workers;
+    vector<std::thread> threads;
+    std::mutex idleLock;
+    std::condition_variable idle;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> next;
+    bool stopping;
+    static size_t& workerIndex()
+    {
+      static thread_local size_t index = 0;
+      return index;
+    }
+    bool take( size_t index, Task& task )
+    {
+      for ( size_t i = 0; i < workers.size(); i++ )
+      {
+        Worker& worker = *workers[( index + i ) % workers.size()];
+        std::lock_guard<std::mutex> lock( worker.lock );
+        if ( worker.tasks.empty() )
+          continue;
+        if ( i == 0 ) {
+          task.swap( worker.tasks.front() );
+          worker.tasks.pop_front();
+        } else {
+          task.swap( worker.tasks.back() );
+          worker.tasks.pop_back();
+        }
+        pending--;
+        return true;
+      }
+      return false;
+    }
+    void run( size_t index )
+    {
+      workerIndex() = index;
+      Task task;
+      for ( ;; )
+      {
+        if ( take( index, task ) ) {
+          task();
+          task = nullptr;
+          continue;
+        }
+        std::unique_lock<std::mutex> lock( idleLock );
+        idle.wait( lock, [this]() { return stopping || pending > 0; } );
+        if ( stopping && pending == 0 )
+          return;
+      }
+    }
+  public:
+    explicit ThreadPool( size_t count = 0 ): pending( 0 ), next( 0 ), stopping( false )
+    {
+      if ( !count )
+        count = defaultSize();
+      for ( size_t i = 0; i < count; i++ )
+        workers.push_back( new Worker() );
+      for ( size_t i = 0; i < count; i++ )
+        threads.push_back( std::thread( &ThreadPool::run, this, i ) );
+    }
+    ~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock( idleLock );
+        stopping = true;
+      }
+      idle.notify_all();
+      for ( size_t i = 0; i < threads.size(); i++ )
+        threads[i].join();
+      for ( size_t i = 0; i < workers.size(); i++ )
+        delete workers[i];
+    }
+    static size_t defaultSize()
+    {
+      size_t count = std::thread::hardware_concurrency();
+      return count ? count : 1;
+    }
+    // Index of the pool worker running the calling thread, for indexing
+    // per-worker state. Zero outside of the pool.
+    static size_t currentWorker()
+    {
+      return workerIndex();
+    }
+    size_t size() const
+    {
+      return workers.size();
+    }
+    void submit( Task task )
+    {
+      Worker& worker = *workers[next++ % workers.size()];
+      {
+        std::lock_guard<std::mutex> lock( worker.lock );
+        worker.tasks.push_back( Task() );
+        worker.tasks.back().swap( task );
+        pending++;
+      }
+      std::lock_guard<std::mutex> lock( idleLock );
+      idle.notify_one();
+    }
+  };
+
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstring>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define CHROMATIC_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+
+namespace chromatic {
+
+  // Bulk transposition of note and triad arrays. Each byte holding a note
+  // (0 to 11) has the interval added and 12 subtracted where the sum
+  // passes B. Bytes that are not notes are left as they are, so arrays of
+  // triads keep their chord type and raw input can carry other data.
+  // Sixteen bytes are done at a time with SSE2 where available, and eight
+  // at a time in a 64-bit word otherwise.
+
+  namespace detail {
+
+    // Per-byte interval for a run of bytes where every byte in a lane
+    // selected by the mask holds a note. The pattern repeats every four
+    // bytes, which fits both plain notes and triads.
+
+    inline unsigned long long transposePattern( Semitones interval, unsigned int laneMask )
+    {
+      unsigned long long step = (unsigned long long)wrapNote( interval % Interval_Octave );
+      unsigned long long pattern = 0;
+      for ( int i = 0; i < 8; i++ )
+        if ( laneMask & ( 1 << ( i % 4 ) ) )
+          pattern |= step << ( i * 8 );
+      return pattern;
+    }
+
+    inline unsigned long long transposeWord( unsigned long long x, unsigned long long add )
+    {
+      const unsigned long long ones = 0x0101010101010101ULL;
+      const unsigned long long high = 0x8080808080808080ULL;
+      // High bit of each byte set where the byte is 11 or less; the high
+      // bits are masked off first so that no sum carries into the next byte
+      unsigned long long valid = ~( ( x & ~high ) + ones * ( 0x80 - 12 ) ) & ~x & high;
+      unsigned long long validMask = ( valid >> 7 ) * 0xFF;
+      unsigned long long y = x + ( add & validMask );
+      // High bit of each valid byte set where the sum is 12 or more
+      unsigned long long wrap = ( ( y & ~high ) + ones * ( 0x80 - 12 ) ) & valid;
+      return y - ( wrap >> 7 ) * 12;
+    }
+
+    inline unsigned char transposeByte( unsigned char x, unsigned char add )
+    {
+      if ( x >= Interval_Octave )
+        return x;
+      unsigned char y = (unsigned char)( x + add );
+      return (unsigned char)( y - ( Interval_Octave & -( y >= Interval_Octave ) ) );
+    }
+
+    inline void transposeBytes( unsigned char* data, size_t count, Semitones interval, unsigned int laneMask )
+    {
+      unsigned long long pattern = transposePattern( interval, laneMask );
+      size_t i = 0;
+#ifdef CHROMATIC_SSE2
+      const __m128i add = _mm_set1_epi32( (int)( pattern & 0xFFFFFFFF ) );
+      const __m128i eleven = _mm_set1_epi8( 11 );
+      const __m128i twelve = _mm_set1_epi8( 12 );
+      for ( ; i + 16 <= count; i += 16 )
+      {
+        __m128i x = _mm_loadu_si128( (const __m128i*)( data + i ) );
+        __m128i valid = _mm_cmpeq_epi8( _mm_min_epu8( x, eleven ), x );
+        __m128i y = _mm_add_epi8( x, _mm_and_si128( add, valid ) );
+        __m128i wrap = _mm_andnot_si128( _mm_cmpeq_epi8( _mm_min_epu8( y, eleven ), y ), valid );
+        _mm_storeu_si128( (__m128i*)( data + i ), _mm_sub_epi8( y, _mm_and_si128( wrap, twelve ) ) );
+      }
+#endif
+      for ( ; i + 8 <= count; i += 8 )
+      {
+        unsigned long long x;
+        memcpy( &x, data + i, 8 );
+        x = transposeWord( x, pattern );
+        memcpy( data + i, &x, 8 );
+      }
+      for ( ; i < count; i++ )
+        data[i] = transposeByte( data[i], (unsigned char)( pattern >> ( ( i % 4 ) * 8 ) ) );
+    }
+
+  }
+
+  inline void transposeNotes( Note* notes, size_t count, Semitones interval )
+  {
+    detail::transposeBytes( (unsigned char*)notes, count, interval, 0xF );
+  }
+
+  inline void transposeTriads( Triad* chords, size_t count, Semitones interval )
+  {
+    detail::transposeBytes( (unsigned char*)chords, count * sizeof( Triad ), interval, 0x7 );
+  }
+
+}
\ No newline at end of file
@@ -45,7 +45,7 @@ namespace chromatic {
 
   // Note
 
-  enum Note: int {
+  enum Note: unsigned char {
     Note_C  = 0,
     Note_Cs = 1,
     Note_Df = 1,
@@ -65,71 +65,80 @@ namespace chromatic {
     Note_B  = 11
   };
 
-  const wchar_t* g_notesSharpStr[12] = {
-    L"C", L"C#", L"D", L"D#", L"E", L"F", L"F#", L"G", L"G#", L"A", L"A#", L"B"
+  const char* g_notesSharpStr[12] = {
+    "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"
   };
 
-  const wchar_t* g_notesFlatStr[12] = {
-    L"C", L"Db", L"D", L"Eb", L"E", L"F", L"Gb", L"G", L"Ab", L"A", L"Bb", L"B"
+  const char* g_notesFlatStr[12] = {
+    "C", "Db", "D", "Eb", "E", "F", "Gb", "G", "Ab", "A", "Bb", "B"
   };
 
+  // Reduces -12 to 23 semitones above C to a note with conditional moves
+  // rather than branches. The operators below bring the interval into -11
+  // to 11 first, which keeps the division off the note's own dependency
+  // chain.
+
+  inline Note wrapNote( int semitones )
+  {
+    int below = semitones + Interval_Octave;
+    int above = semitones - Interval_Octave;
+    semitones = semitones < 0 ? below : semitones;
+    return (Note)( above >= 0 ? above : semitones );
+  }
+
   inline Note operator +( const Note& n, Semitones i )
   {
-    int t = (int)n + i;
-    while ( t > Note_B )
-      t -= Interval_Octave;
-    return (Note)t;
+    return wrapNote( (int)n + i % Interval_Octave );
   }
 
   inline Note operator -( const Note& n, Semitones i )
   {
-    int t = (int)n - i;
-    while ( t < Note_C )
-      t += Interval_Octave;
-    return (Note)t;
+    return wrapNote( (int)n - i % Interval_Octave );
   }
 
   inline Note& operator +=( Note& n, Semitones i )
   {
-    int t = (int)n + i;
-    while ( t > Note_B )
-      t -= Interval_Octave;
-    n = (Note)t;
+    n = wrapNote( (int)n + i % Interval_Octave );
     return n;
   }
 
   inline Note& operator -=( Note& n, Semitones i )
   {
-    int t = (int)n - i;
-    while ( t < Note_C )
-      t += Interval_Octave;
-    n = (Note)t;
+    n = wrapNote( (int)n - i % Interval_Octave );
     return n;
   }
 
   inline Note& operator ++( Note& n )
   {
-    int t = (int)n;
-    t++;
-    while ( t > Note_B )
-      t -= Interval_Octave;
-    n = (Note)t;
+    n = wrapNote( (int)n + 1 );
     return n;
   }
 
   inline Note& operator --( Note& n )
   {
-    int t = (int)n;
-    t--;
-    while ( t < Note_C )
-      t += Interval_Octave;
-    n = (Note)t;
+    n = wrapNote( (int)n - 1 );
     return n;
   }
 
+  // Pitch, as a MIDI note number where middle C (C4) is 60
+
+  typedef unsigned char Pitch;
+
+  const Pitch Pitch_Highest = 127;
+
+  inline Note pitchClass( Pitch pitch )
+  {
+    return (Note)( pitch % Interval_Octave );
+  }
+
+  inline int pitchOctave( Pitch pitch )
+  {
+    return pitch / Interval_Octave - 1;
+  }
+
   // Degree
 
-  enum Degree: int {
+  enum Degree: unsigned char {
     Degree_Tonic = 0,
     Degree_Supertonic,
     Degree_Mediant,
@@ -151,4 +160,11 @@ namespace chromatic {
     return d;
   }
 
+  // Names are compared ignoring ASCII case
+
+  inline char lowerAscii( char c )
+  {
+    return ( c >= 'A' && c <= 'Z' ) ? (char)( c | 0x20 ) : c;
+  }
+
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticChordProgression.h"
+#include "chromaticPitchClassSet.h"
+
+namespace chromatic {
+
+  using std::vector;
+
+  // A triad played as three pitches from the bass up
+
+  struct Voicing {
+    Pitch voices[3];
+    Inversion getInversion( const Triad& chord ) const
+    {
+      Note bass = pitchClass( voices[0] );
+      if ( bass == chord.second )
+        return Inversion_First;
+      if ( bass == chord.third )
+        return Inversion_Second;
+      return Inversion_Root;
+    }
+    int getSpread() const
+    {
+      return voices[2] - voices[0];
+    }
+  };
+
+  typedef vector<Voicing> VoicingVector;
+
+  // Widest gap allowed between neighbouring voices
+
+  const int g_voicingMaxGap = Interval_Octave;
+
+  inline bool voicingLess( const Voicing& a, const Voicing& b )
+  {
+    if ( a.getSpread() != b.getSpread() )
+      return a.getSpread() < b.getSpread();
+    return a.voices[0] < b.voices[0];
+  }
+
+  // Chooses a voicing for every chord of a progression so that the voices
+  // move as little as possible in total, measured in semitones, while
+  // staying within a range of pitches. This is a shortest path through
+  // the voicings of each step, found by dynamic programming in time linear
+  // in the length of the progression. Voicings of each triad and the cost
+  // of moving between the voicings of two triads are tabulated the first
+  // time they are needed.
+
+  class VoiceLeader {
+  protected:
+    Pitch low;
+    Pitch high;
+    bool built[72];
+    VoicingVector voicings[72];
+    vector<unsigned short> costs[72][72];
+    vector<unsigned int> scores;
+    vector<unsigned int> nextScores;
+    vector<unsigned short> parents;
+    static int triadCode( const Triad& chord )
+    {
+      return chord.first * 6 + chord.type;
+    }
+    const VoicingVector& triadVoicings( int code )
+    {
+      if ( built[code] )
+        return voicings[code];
+      built[code] = true;
+      Triad chord( (Note)( code / 6 ), (ChordType)( code % 6 ) );
+      PitchClassSet notes( chord );
+      vector<Pitch> pitches;
+      for ( int pitch = low; pitch <= high; pitch++ )
+        if ( notes.contains( pitchClass( (Pitch)pitch ) ) )
+          pitches.push_back( (Pitch)pitch );
+      VoicingVector& result = voicings[code];
+      for ( size_t i = 0; i < pitches.size(); i++ )
+        for ( size_t j = i + 1; j < pitches.size() && pitches[j] - pitches[i] <= g_voicingMaxGap; j++ )
+          for ( size_t k = j + 1; k < pitches.size() && pitches[k] - pitches[j] <= g_voicingMaxGap; k++ )
+          {
+            PitchClassSet played;
+            played.add( pitchClass( pitches[i] ) );
+            played.add( pitchClass( pitches[j] ) );
+            played.add( pitchClass( pitches[k] ) );
+            if ( played != notes )
+              continue;
+            Voicing voicing = { { pitches[i], pitches[j], pitches[k] } };
+            result.push_back( voicing );
+          }
+      std::sort( result.begin(), result.end(), voicingLess );
+      return result;
+    }
+    // Movement from each voicing of one triad to each voicing of another,
+    // row by row
+    const unsigned short* transitionCosts( int from, int to )
+    {
+      vector<unsigned short>& table = costs[from][to];
+      if ( table.empty() ) {
+        const VoicingVector& a = triadVoicings( from );
+        const VoicingVector& b = triadVoicings( to );
+        table.resize( a.size() * b.size() );
+        for ( size_t i = 0; i < a.size(); i++ )
+          for ( size_t j = 0; j < b.size(); j++ )
+            table[i * b.size() + j] = (unsigned short)(
+              abs( a[i].voices[0] - b[j].voices[0] ) +
+              abs( a[i].voices[1] - b[j].voices[1] ) +
+              abs( a[i].voices[2] - b[j].voices[2] ) );
+      }
+      return &table[0];
+    }
+  public:
+    VoiceLeader( Pitch _low, Pitch _high ): low( _low ), high( _high )
+    {
+      memset( built, 0, sizeof( built ) );
+    }
+    const VoicingVector& getVoicings( const Triad& chord )
+    {
+      return triadVoicings( triadCode( chord ) );
+    }
+    // Fills in the voicing of every step and returns the total movement, or
+    // -1 if some chord cannot be voiced within the range
+    int lead( const ProgressionVector& steps, VoicingVector& result )
+    {
+      result.clear();
+      if ( steps.empty() )
+        return 0;
+      size_t offset = 0;
+      parents.clear();
+      for ( size_t step = 0; step < steps.size(); step++ )
+      {
+        int code = triadCode( steps[step].chord );
+        const VoicingVector& current = triadVoicings( code );
+        if ( current.empty() )
+          return -1;
+        if ( !step ) {
+          scores.assign( current.size(), 0 );
+          continue;
+        }
+        int previous = triadCode( steps[step - 1].chord );
+        size_t count = triadVoicings( previous ).size();
+        const unsigned short* table = transitionCosts( previous, code );
+        nextScores.assign( current.size(), 0xFFFFFFFF );
+        parents.resize( offset + current.size() );
+        for ( size_t i = 0; i < count; i++ )
+        {
+          const unsigned short* row = table + i * current.size();
+          for ( size_t j = 0; j < current.size(); j++ )
+          {
+            unsigned int score = scores[i] + row[j];
+            if ( score < nextScores[j] ) {
+              nextScores[j] = score;
+              parents[offset + j] = (unsigned short)i;
+            }
+          }
+        }
+        offset += current.size();
+        scores.swap( nextScores );
+      }
+      size_t best = std::min_element( scores.begin(), scores.end() ) - scores.begin();
+      int total = (int)scores[best];
+      result.resize( steps.size() );
+      for ( size_t step = steps.size() - 1; ; step-- )
+      {
+        const VoicingVector& current = triadVoicings( triadCode( steps[step].chord ) );
+        result[step] = current[best];
+        if ( !step )
+          break;
+        offset -= current.size();
+        best = parents[offset + best];
+      }
+      return total;
+    }
+  };
+
+}
\ No newline at end of file
@@ -0,0 +1,444 @@
+//
+// Chromatic musical utility
+// Copyright (c) 2012 noorus
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "chromaticTypes.h"
+#include "chromaticChords.h"
+#include "chromaticScales.h"
+#include "chromaticParser.h"
+#include "chromaticChordProgression.h"
+#include "chromaticOutput.h"
+#include "chromaticTranspose.h"
+#include "chromaticKey.h"
+#include "chromaticProgressionFile.h"
+#include "chromaticMarkov.h"
+#include "chromaticAllocations.h"
+
+using namespace chromatic;
+
+typedef std::chrono::steady_clock Clock;
+
+// Benchmark harness
+
+struct BenchmarkOptions {
+  double seconds;
+  bool json;
+  const char* filter;
+  BenchmarkOptions(): seconds( 0.5 ), json( false ), filter( NULL ) {}
+};
+
+BenchmarkOptions g_options;
+volatile unsigned long long g_sink = 0;
+
+// Runs body repeatedly until the time budget is spent. body performs
+// opsPerRound operations and returns a checksum that keeps the optimizer
+// from discarding the work.
+
+template <class Body>
+void benchmark( const char* name, size_t opsPerRound, Body body )
+{
+  if ( g_options.filter && !strstr( name, g_options.filter ) )
+    return;
+  g_sink += body();
+  unsigned long long ops = 0, rounds = 0, allocations = g_allocations.load();
+  double seconds = 0.0;
+  Clock::time_point start = Clock::now();
+  while ( seconds < g_options.seconds )
+  {
+    for ( int i = 0; i < 64; i++ )
+      g_sink += body();
+    rounds += 64;
+    seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+  }
+  allocations = g_allocations.load() - allocations;
+  ops = rounds * opsPerRound;
+  double nsPerOp = seconds * 1e9 / ops;
+  double allocsPerOp = (double)allocations / ops;
+  double opsPerSec = ops / seconds;
+  if ( g_options.json )
+    printf( "{\"name\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f,\"ops_per_sec\":%.0f}\n",
+      name, ops, seconds, nsPerOp, allocsPerOp, opsPerSec );
+  else
+    printf( "%-24s %12llu ops %9.3f ns/op %8.4f allocs/op %10.2f M ops/sec\n",
+      name, ops, nsPerOp, allocsPerOp, opsPerSec / 1e6 );
+  fflush( stdout );
+}
+
+// Inputs: every chord and scale name the parser accepts, in both spellings
+// and alternating case, and sets of progressions of typical length, one of
+// plain numerals and one using applied, borrowed and inverted chords.
+
+struct Corpus {
+  vector<string> chords;
+  vector<string> scales;
+  vector<string> progressions;
+  vector<string> extended;
+  vector<StringView> chordViews;
+  vector<StringView> scaleViews;
+  vector<StringView> progressionViews;
+  vector<StringView> extendedViews;
+  vector<Triad> triads;
+  vector<Scale> scaleValues;
+  Corpus()
+  {
+    for ( int root = Note_C; root <= Note_B; root++ )
+    {
+      const char* spellings[2] = { g_notesSharpStr[root], g_notesFlatStr[root] };
+      for ( int i = 0; i < 2; i++ )
+      {
+        for ( int type = ChordType_Major; type <= ChordType_SuspendedSecond; type++ )
+        {
+          string name = string( spellings[i] ) + g_chordsSuffixStr[type];
+          if ( type % 2 )
+            name[0] = (char)tolower( name[0] );
+          chords.push_back( name );
+        }
+        scales.push_back( spellings[i] );
+        scales.push_back( string( spellings[i] ) + "m" );
+        scales.push_back( string( spellings[i] ) + ":dorian" );
+      }
+      for ( int type = ChordType_Major; type <= ChordType_SuspendedSecond; type++ )
+        triads.push_back( Triad( (Note)root, (ChordType)type ) );
+      for ( int mode = ScaleMode_Minor; mode <= ScaleMode_Blues; mode++ )
+        scaleValues.push_back( Scale( (Note)root, (ScaleMode)mode ) );
+    }
+    const char* numerals[7] = { "I", "ii", "iii", "IV", "V", "vi", "vii" };
+    for ( int i = 0; i < 16; i++ )
+    {
+      string progression;
+      for ( int step = 0; step < 16; step++ )
+      {
+        if ( step )
+          progression.append( "-" );
+        progression.append( numerals[( i * 3 + step * 5 ) % 7] );
+      }
+      progressions.push_back( progression );
+    }
+    const char* extendedNumerals[7] = { "I", "V/V", "bVII", "IV6", "V64", "viio/ii", "Vsus4" };
+    for ( int i = 0; i < 16; i++ )
+    {
+      string progression;
+      for ( int step = 0; step < 16; step++ )
+      {
+        if ( step )
+          progression.append( "-" );
+        progression.append( extendedNumerals[( i * 3 + step * 5 ) % 7] );
+      }
+      extended.push_back( progression );
+    }
+    chordViews.assign( chords.begin(), chords.end() );
+    scaleViews.assign( scales.begin(), scales.end() );
+    progressionViews.assign( progressions.begin(), progressions.end() );
+    extendedViews.assign( extended.begin(), extended.end() );
+  }
+};
+
+void benchmarkNotes()
+{
+  const int count = 1024;
+  benchmark( "note/add", count, [&]() {
+    Note n = Note_C;
+    unsigned long long sum = 0;
+    for ( int i = 0; i < count; i++ )
+    {
+      n = n + ( i & 15 );
+      sum += n;
+    }
+    return sum;
+  } );
+  benchmark( "note/subtract", count, [&]() {
+    Note n = Note_B;
+    unsigned long long sum = 0;
+    for ( int i = 0; i < count; i++ )
+    {
+      n = n - ( i & 15 );
+      sum += n;
+    }
+    return sum;
+  } );
+  benchmark( "note/compound", count, [&]() {
+    Note n = Note_C;
+    unsigned long long sum = 0;
+    for ( int i = 0; i < count; i++ )
+    {
+      n += ( i & 7 );
+      n -= ( i & 3 );
+      sum += n;
+    }
+    return sum;
+  } );
+  benchmark( "note/increment", count, [&]() {
+    Note n = Note_C;
+    unsigned long long sum = 0;
+    for ( int i = 0; i < count; i++ )
+    {
+      ++n;
+      sum += n;
+    }
+    return sum;
+  } );
+  vector<Note> notes( 1 << 16 );
+  for ( size_t i = 0; i < notes.size(); i++ )
+    notes[i] = (Note)( ( i * 7 ) % 12 );
+  benchmark( "note/transpose/scalar", notes.size(), [&]() {
+    for ( size_t i = 0; i < notes.size(); i++ )
+      notes[i] += 5;
+    return (unsigned long long)notes[notes.size() - 1];
+  } );
+  benchmark( "note/transpose/bulk", notes.size(), [&]() {
+    transposeNotes( &notes[0], notes.size(), 5 );
+    return (unsigned long long)notes[notes.size() - 1];
+  } );
+  KeyTracker tracker( 256 );
+  benchmark( "note/key/window", notes.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < notes.size(); i++ )
+    {
+      tracker.push( notes[i] );
+      sum += tracker.getBest();
+    }
+    return sum;
+  } );
+  float histogram[12];
+  for ( int i = 0; i < 12; i++ )
+    histogram[i] = (float)( i * 7 % 12 );
+  KeyEstimateVector estimates;
+  benchmark( "note/key/estimate", 1, [&]() {
+    estimateKeys( histogram, estimates );
+    return (unsigned long long)estimates[0].scale.getRoot();
+  } );
+}
+
+void benchmarkTriads( const Corpus& corpus )
+{
+  benchmark( "triad/construct", corpus.triads.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.triads.size(); i++ )
+    {
+      Triad chord( corpus.triads[i].first, corpus.triads[i].type );
+      sum += chord.third;
+    }
+    return sum;
+  } );
+  vector<Triad> triads( 1 << 14 );
+  for ( size_t i = 0; i < triads.size(); i++ )
+    triads[i] = corpus.triads[i % corpus.triads.size()];
+  benchmark( "triad/transpose/bulk", triads.size(), [&]() {
+    transposeTriads( &triads[0], triads.size(), 7 );
+    return (unsigned long long)triads[triads.size() - 1].third;
+  } );
+  benchmark( "triad/getName", corpus.triads.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.triads.size(); i++ )
+      sum += corpus.triads[i].getName()[0];
+    return sum;
+  } );
+  benchmark( "triad/getString", corpus.triads.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.triads.size(); i++ )
+      sum += corpus.triads[i].getString()[0];
+    return sum;
+  } );
+}
+
+void benchmarkScales( const Corpus& corpus )
+{
+  benchmark( "scale/construct", corpus.scaleValues.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.scaleValues.size(); i++ )
+    {
+      Scale scale( corpus.scaleValues[i].getRoot(), corpus.scaleValues[i].getMode() );
+      sum += scale.getNotes()[6];
+    }
+    return sum;
+  } );
+  benchmark( "scale/getTriad", corpus.scaleValues.size() * 7, [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.scaleValues.size(); i++ )
+      for ( Degree degree = Degree_Tonic; degree <= Degree_Subsemitone; ++degree )
+        sum += corpus.scaleValues[i].getTriad( degree ).second;
+    return sum;
+  } );
+  for ( int format = OutputFormat_Text; format <= OutputFormat_Csv; format++ )
+  {
+    OutputWriter writer( (OutputFormat)format, NULL );
+    std::string name = std::string( "scale/print/" ) + ( format == OutputFormat_Text ? "text" : format == OutputFormat_Json ? "json" : "csv" );
+    benchmark( name.c_str(), corpus.scaleValues.size(), [&]() {
+      unsigned long long sum = 0;
+      for ( size_t i = 0; i < corpus.scaleValues.size(); i++ )
+      {
+        writer.writeScale( corpus.scaleValues[i] );
+        sum += writer.getBuffer().length();
+        writer.getBuffer().clear();
+      }
+      return sum;
+    } );
+  }
+}
+
+void benchmarkParsers( const Corpus& corpus )
+{
+  benchmark( "parse/chord", corpus.chordViews.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.chordViews.size(); i++ )
+    {
+      Triad chord;
+      ParseError error;
+      if ( parseChord( corpus.chordViews[i], chord, error ) )
+        sum += chord.third;
+    }
+    return sum;
+  } );
+  benchmark( "parse/scale", corpus.scaleViews.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.scaleViews.size(); i++ )
+    {
+      Scale scale;
+      ParseError error;
+      if ( parseScale( corpus.scaleViews[i], scale, error ) )
+        sum += scale.getRoot();
+    }
+    return sum;
+  } );
+}
+
+void benchmarkProgressions( const Corpus& corpus )
+{
+  ChordProgression progression( Scale( Note_A, ScaleMode_Minor ) );
+  benchmark( "progression/parse", corpus.progressionViews.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.progressionViews.size(); i++ )
+    {
+      ParseError error;
+      if ( progression.parse( corpus.progressionViews[i], error ) )
+        sum += progression.getSteps().size();
+    }
+    return sum;
+  } );
+  benchmark( "progression/parse/extended", corpus.extendedViews.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < corpus.extendedViews.size(); i++ )
+    {
+      ParseError error;
+      if ( progression.parse( corpus.extendedViews[i], error ) )
+        sum += progression.getSteps().size();
+    }
+    return sum;
+  } );
+  vector<ChordProgression> parsed;
+  for ( size_t i = 0; i < corpus.progressionViews.size(); i++ )
+  {
+    ParseError error;
+    progression.parse( corpus.progressionViews[i], error );
+    parsed.push_back( progression );
+  }
+  for ( size_t i = 0; i < corpus.extendedViews.size(); i++ )
+  {
+    ParseError error;
+    progression.parse( corpus.extendedViews[i], error );
+    parsed.push_back( progression );
+  }
+  // One block of the binary file format, alternating plain and extended
+  vector<unsigned char> packed;
+  size_t packedCount = 0;
+  while ( packed.size() + 64 < g_progressionBlockSize )
+    encodeProgression( parsed[packedCount++ % parsed.size()], 0, packed );
+  ScaleMode packedModes[1] = { ScaleMode_Minor };
+  benchmark( "progression/packed/scan", packedCount, [&]() {
+    unsigned long long sum = 0;
+    ProgressionCursor cursor( &packed[0], &packed[0] + packed.size(), packedModes, 1 );
+    PackedProgression stored;
+    while ( cursor.next( stored ) )
+      sum += stored.size;
+    return sum;
+  } );
+  benchmark( "progression/packed/decode", packedCount, [&]() {
+    unsigned long long sum = 0;
+    ProgressionCursor cursor( &packed[0], &packed[0] + packed.size(), packedModes, 1 );
+    PackedProgression stored;
+    ChordProgressionStep step( Degree_Tonic, Triad() );
+    while ( cursor.next( stored ) )
+    {
+      for ( const unsigned char* pos = stored.steps, *end = pos + stored.size; pos < end; )
+      {
+        decodeStep( stored.scale, pos, step );
+        sum += step.chord.third;
+      }
+    }
+    return sum;
+  } );
+  // A second order model of the corpus, sampled in C major
+  MarkovModel model( 2 );
+  for ( size_t i = 0; i < parsed.size(); i++ )
+  {
+    vector<unsigned char> states;
+    for ( size_t j = 0; j < parsed[i].getSteps().size(); j++ )
+      states.push_back( markovState( parsed[i].getSteps()[j].degree, parsed[i].getSteps()[j].chord.type ) );
+    model.add( &states[0], states.size() );
+  }
+  MarkovSampler sampler( model, Scale( Note_C, ScaleMode_Major ) );
+  SplitMix random( 1 );
+  const int samples = 1024;
+  benchmark( "progression/markov/sample", samples, [&]() {
+    unsigned long long sum = 0;
+    unsigned char states[g_markovMaxLength];
+    for ( int i = 0; i < samples; i++ )
+      sum += sampler.sample( random, states, 16 );
+    return sum;
+  } );
+  OutputWriter writer( OutputFormat_Text, NULL );
+  benchmark( "progression/print/text", parsed.size(), [&]() {
+    unsigned long long sum = 0;
+    for ( size_t i = 0; i < parsed.size(); i++ )
+    {
+      writer.writeProgression( parsed[i] );
+      sum += writer.getBuffer().length();
+      writer.getBuffer().clear();
+    }
+    return sum;
+  } );
+}
+
+int main( int argc, char* argv[] )
+{
+  for ( int i = 1; i < argc; i++ )
+  {
+    if ( !strcmp( argv[i], "--json" ) )
+      g_options.json = true;
+    else if ( !strncmp( argv[i], "--time=", 7 ) )
+      g_options.seconds = atof( argv[i] + 7 );
+    else if ( !strncmp( argv[i], "--filter=", 9 ) )
+      g_options.filter = argv[i] + 9;
+    else {
+      fprintf( stderr, "Syntax: %s [--json] [--time=<seconds per benchmark>] [--filter=<name substring>]\n", argv[0] );
+      return EXIT_FAILURE;
+    }
+  }
+  Corpus corpus;
+  benchmarkNotes();
+  benchmarkTriads( corpus );
+  benchmarkScales( corpus );
+  benchmarkParsers( corpus );
+  benchmarkProgressions( corpus );
+  return EXIT_SUCCESS;
+}
\ No newline at end of file